@@ -1,9 +1,102 @@
 #include <cstdlib>
+#include <memory_resource>
+#include <string>
+#include <utility>
 
 #include "cmark.h"
+#include "cmark.hpp"
 #include "cplusplus.h"
 #include "harness.h"
 
+namespace {
+
+// Counts live bytes to check that everything allocated is given back.
+class counting_resource : public std::pmr::memory_resource {
+public:
+  std::size_t live = 0;
+  std::size_t allocations = 0;
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    live += bytes;
+    allocations++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    live -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+};
+
+void document_views(test_batch_runner *runner) {
+  cmark::Document doc =
+      cmark::Document::parse("# Title\n\n```cpp\nx\n```\n\n[a](/u \"t\")\n");
+  int count = 0;
+  for (cmark::Node child : doc.children()) {
+    (void)child;
+    count++;
+  }
+  INT_EQ(runner, count, 3, "cpp_children");
+
+  cmark::Node heading = doc.root().first_child();
+  INT_EQ(runner, heading.heading_level(), 1, "cpp_heading_level");
+  OK(runner, heading.first_child().literal() == "Title", "cpp_literal");
+  cmark::Node code = heading.next();
+  OK(runner, code.fence_info() == "cpp", "cpp_fence_info");
+  OK(runner, code.literal() == "x\n", "cpp_code_literal");
+  cmark::Node link = code.next().first_child();
+  OK(runner, link.url() == "/u", "cpp_url");
+  OK(runner, link.title() == "t", "cpp_title");
+  OK(runner, link.literal().empty(), "cpp_no_literal");
+  OK(runner, link.parent() == code.next(), "cpp_parent");
+
+  int enters = 0, exits = 0;
+  for (cmark::Event ev : doc.events()) {
+    if (ev.type == CMARK_EVENT_ENTER) {
+      enters++;
+    } else if (ev.type == CMARK_EVENT_EXIT) {
+      exits++;
+    }
+  }
+  INT_EQ(runner, enters, 7, "cpp_enter_events");
+  INT_EQ(runner, exits, 4, "cpp_exit_events");
+
+  cmark::Document moved = std::move(doc);
+  OK(runner, !doc && moved, "cpp_document_move");
+  STR_EQ(runner, moved.commonmark().c_str(),
+         "# Title\n\n``` cpp\nx\n```\n\n[a](/u \"t\")\n", "cpp_render");
+
+  cmark::Document copy = moved.clone();
+  OK(runner, copy.get() != moved.get() &&
+                 copy.commonmark() == moved.commonmark(),
+     "cpp_clone");
+}
+
+void memory_resource(test_batch_runner *runner) {
+  counting_resource resource;
+  {
+    cmark::Parser parser(CMARK_OPT_DEFAULT, &resource);
+    parser.feed("- one\n- *two*\n");
+    parser.feed("\n[x]: /y\n");
+    cmark::Parser other = std::move(parser);
+    cmark::Document doc = other.finish();
+    OK(runner, resource.allocations > 0, "cpp_pmr_used");
+    STR_EQ(runner, doc.commonmark().c_str(), "  - one\n  - *two*\n",
+           "cpp_pmr_render");
+  }
+  OK(runner, resource.live == 0, "cpp_pmr_balanced");
+}
+
+} // namespace
+
 void
 test_cplusplus(test_batch_runner *runner)
-{ }
+{
+  document_views(runner);
+  memory_resource(runner);
+}
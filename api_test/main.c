@@ -87,7 +87,9 @@ static void test_mlem_blocks(test_batch_runner *runner) {
   cmark_node *spoiler = cmark_node_next(heading);
   INT_EQ(runner, spoiler->type, CMARK_NODE_SPOILER, "mlem_spoiler");
   STR_EQ(runner, cmark_node_get_title(spoiler), "spoiler_title", "mlem_get_spoiler_title");
+#ifndef CMARK_LEAN_NODES
   INT_EQ(runner, cmark_node_get_end_line(spoiler), 5, "mlem_spoiler_end");
+#endif
 
   cmark_node *spoiler_content = cmark_node_first_child(spoiler);
   INT_EQ(runner, spoiler_content->type, CMARK_NODE_BLOCK_QUOTE, "mlem_spoiler_content");
@@ -178,9 +180,11 @@ static void accessors(test_batch_runner *runner) {
          "get_literal indented code");
 
   cmark_node *paragraph = cmark_node_next(code);
+#ifndef CMARK_LEAN_NODES
   INT_EQ(runner, cmark_node_get_start_line(paragraph), 15, "get_start_line");
   INT_EQ(runner, cmark_node_get_start_column(paragraph), 1, "get_start_column");
   INT_EQ(runner, cmark_node_get_end_line(paragraph), 15, "get_end_line");
+#endif
 
   cmark_node *link = cmark_node_first_child(paragraph);
   STR_EQ(runner, cmark_node_get_url(link), "url", "get_url");
@@ -620,6 +624,1551 @@ static void sub_document(test_batch_runner *runner) {
   cmark_node_free(doc);
 }
 
+static void preview(test_batch_runner *runner) {
+  static const char markdown[] = "# Title\n"
+                                 "\n"
+                                 "[ref]: /url\n"
+                                 "\n"
+                                 "First *para*\n"
+                                 "still first\n"
+                                 "\n"
+                                 "- second\n"
+                                 "- block\n"
+                                 "\n"
+                                 "third\n";
+  cmark_node *doc;
+  char *cmark;
+
+  doc = cmark_parse_document_preview(markdown, sizeof(markdown) - 1,
+                                     CMARK_OPT_DEFAULT, 2, 0);
+  OK(runner, cmark_node_get_truncated(doc), "preview_blocks_truncated");
+  cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "# Title\n\nFirst *para*\nstill first\n",
+         "preview_blocks");
+  free(cmark);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document_preview(markdown, sizeof(markdown) - 1,
+                                     CMARK_OPT_DEFAULT, 4, 0);
+  OK(runner, !cmark_node_get_truncated(doc), "preview_whole_document");
+  cmark_node_free(doc);
+
+  // The byte limit cuts at the end of the line crossing it.
+  doc = cmark_parse_document_preview(markdown, sizeof(markdown) - 1,
+                                     CMARK_OPT_DEFAULT, 0, 30);
+  OK(runner, cmark_node_get_truncated(doc), "preview_bytes_truncated");
+  cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "# Title\n\nFirst *para*\n", "preview_bytes");
+  free(cmark);
+  cmark_node_free(doc);
+
+  // Streaming in small pieces gives the same result.
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_parser_set_preview_limits(parser, 2, 0);
+  for (size_t i = 0; i < sizeof(markdown) - 1; i += 3) {
+    size_t len = sizeof(markdown) - 1 - i;
+    cmark_parser_feed(parser, markdown + i, len < 3 ? len : 3);
+  }
+  doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+  OK(runner, cmark_node_get_truncated(doc), "preview_stream_truncated");
+  cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "# Title\n\nFirst *para*\nstill first\n",
+         "preview_stream");
+  free(cmark);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  OK(runner, !cmark_node_get_truncated(doc), "full_parse_not_truncated");
+  cmark_node_free(doc);
+}
+
+static void lazy_inlines(test_batch_runner *runner) {
+  static const char markdown[] = "# *Title*\n"
+                                 "\n"
+                                 "> see [ref]\n"
+                                 "\n"
+                                 "[ref]: /url\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_LAZY_INLINES);
+  cmark_node *heading = cmark_node_first_child(doc);
+  cmark_node *quote = cmark_node_next(heading);
+  cmark_node *para = quote->first_child;
+
+  OK(runner, heading->flags & CMARK_NODE__INLINES_PENDING,
+     "lazy_heading_pending");
+  OK(runner, heading->first_child == NULL, "lazy_heading_unparsed");
+  cmark_node *emph = cmark_node_first_child(heading);
+  INT_EQ(runner, cmark_node_get_type(emph), CMARK_NODE_EMPH,
+         "lazy_heading_parsed");
+  OK(runner, !(heading->flags & CMARK_NODE__INLINES_PENDING),
+     "lazy_heading_not_pending");
+  OK(runner, para->flags & CMARK_NODE__INLINES_PENDING,
+     "lazy_other_block_pending");
+
+  // Detaching a block parses its pending inlines with the
+  // document's references.
+  cmark_node_unlink(quote);
+  cmark_node_free(doc);
+  OK(runner, !(para->flags & CMARK_NODE__INLINES_PENDING),
+     "lazy_unlinked_parsed");
+  cmark_node *link = cmark_node_next(cmark_node_first_child(para));
+  STR_EQ(runner, cmark_node_get_url(link), "/url", "lazy_reference_link");
+  cmark_node_free(quote);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_LAZY_INLINES);
+  char *cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "# *Title*\n\n> see [ref](/url)\n",
+         "lazy_render_commonmark");
+  free(cmark);
+  cmark_node_free(doc);
+
+  // ... and with the document's options.
+  doc = cmark_parse_document("> \"hi\" @a@b.c www.d.io\n", 23,
+                             CMARK_OPT_LAZY_INLINES | CMARK_OPT_SMART |
+                                 CMARK_OPT_MENTIONS |
+                                 CMARK_OPT_AUTOLINK_URLS);
+  quote = cmark_node_first_child(doc);
+  cmark_node_unlink(quote);
+  cmark_node_free(doc);
+  para = cmark_node_first_child(quote);
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(para)),
+         "\xe2\x80\x9chi\xe2\x80\x9d ", "lazy_unlinked_smart");
+  INT_EQ(runner, cmark_node_get_type(cmark_node_last_child(para)),
+         CMARK_NODE_LINK, "lazy_unlinked_autolink");
+  INT_EQ(runner,
+         cmark_node_get_type(cmark_node_next(cmark_node_first_child(para))),
+         CMARK_NODE_LINK, "lazy_unlinked_mention");
+  cmark_node_free(quote);
+}
+
+static void backtick_spans(test_batch_runner *runner) {
+  static const char markdown[] = "`a` ``b`` ```` c ```` `` `d` x\n"
+                                 "```````````````````````````` e"
+                                 " ````````````````````````````\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  char *cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "`a` `b` `c` \\`\\` `d` x\n`e`\n",
+         "backtick_spans");
+  free(cmark);
+  cmark_node_free(doc);
+}
+
+static void delimiter_stacks(test_batch_runner *runner) {
+  // Several blocks share the stack storage during a parse.
+  static const char markdown[] = "*a [b **c** ~d~](/u) ^e^ ~~f~~ _g\n"
+                                 "\n"
+                                 "[h *i* [j](/k) l] **m** n*\n"
+                                 "\n"
+                                 "# *o* [p](/q) r_\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  char *cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark,
+         "\\*a [b **c** ~d~](/u) ^e^ ~~f~~ \\_g\n"
+         "\n"
+         "\\[h *i* [j](/k) l\\] **m** n\\*\n"
+         "\n"
+         "# *o* [p](/q) r\\_\n",
+         "delimiter_stacks");
+  free(cmark);
+  cmark_node_free(doc);
+}
+
+static void text_merging(test_batch_runner *runner) {
+  static const char markdown[] = "a &amp; [b *c\\* d! e_\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_SOURCEPOS);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *text = cmark_node_first_child(para);
+
+  INT_EQ(runner, cmark_node_get_type(text), CMARK_NODE_TEXT,
+         "merged_text_type");
+  OK(runner, cmark_node_next(text) == NULL, "merged_text_single_node");
+  STR_EQ(runner, cmark_node_get_literal(text), "a & [b *c* d! e_",
+         "merged_text_literal");
+#ifndef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_start_column(text), 1,
+         "merged_text_start_column");
+  INT_EQ(runner, cmark_node_get_end_column(text), 21,
+         "merged_text_end_column");
+#endif
+  cmark_node_free(doc);
+}
+
+static void block_starts(test_batch_runner *runner) {
+  static const char markdown[] = "> quote\n"
+                                 "# heading\n"
+                                 "```\ncode\n```\n"
+                                 "::: spoiler title\nhidden\n:::\n"
+                                 "setext\n===\n"
+                                 "***\n"
+                                 "+ item\n"
+                                 "\n"
+                                 "3) item\n"
+                                 "\n"
+                                 "text\n"
+                                 "\n"
+                                 "    indented\n"
+                                 "\n"
+                                 "plain\n";
+  static const cmark_node_type expected[] = {
+      CMARK_NODE_BLOCK_QUOTE,    CMARK_NODE_HEADING, CMARK_NODE_CODE_BLOCK,
+      CMARK_NODE_SPOILER,        CMARK_NODE_HEADING, CMARK_NODE_THEMATIC_BREAK,
+      CMARK_NODE_LIST,           CMARK_NODE_LIST,    CMARK_NODE_PARAGRAPH,
+      CMARK_NODE_CODE_BLOCK,     CMARK_NODE_PARAGRAPH};
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *node = cmark_node_first_child(doc);
+  size_t i;
+
+  for (i = 0; i < sizeof(expected) / sizeof(*expected) && node; i++) {
+    INT_EQ(runner, cmark_node_get_type(node), expected[i], "block_start %d",
+           (int)i);
+    node = cmark_node_next(node);
+  }
+  INT_EQ(runner, (int)i, (int)(sizeof(expected) / sizeof(*expected)),
+         "block_start_count");
+  OK(runner, node == NULL, "block_start_no_extra");
+  cmark_node_free(doc);
+}
+
+static void smart_punct(test_batch_runner *runner) {
+  static const char markdown[] = "\"Hi\" -- it's... a *test*---ok\n";
+  cmark_node *doc;
+  cmark_node *text;
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1, CMARK_OPT_SMART);
+  text = cmark_node_first_child(cmark_node_first_child(doc));
+  STR_EQ(runner, cmark_node_get_literal(text),
+         "\xE2\x80\x9CHi\xE2\x80\x9D \xE2\x80\x93 it\xE2\x80\x99s"
+         "\xE2\x80\xA6 a ",
+         "smart_punct");
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  text = cmark_node_first_child(cmark_node_first_child(doc));
+  STR_EQ(runner, cmark_node_get_literal(text), "\"Hi\" -- it's... a ",
+         "no_smart_punct");
+  cmark_node_free(doc);
+}
+
+static void length_accessors(test_batch_runner *runner) {
+  static const char markdown[] = "::: spoiler Title\n"
+                                 "x\n"
+                                 ":::\n"
+                                 "\n"
+                                 "```rust\n"
+                                 "code\n"
+                                 "```\n"
+                                 "\n"
+                                 "a [b](/u \"t\") <http://x.y> [c]\n"
+                                 "\n"
+                                 "[c]: /ref\n";
+  cmark_node *doc =
+      cmark_parse_document(markdown, sizeof(markdown) - 1, CMARK_OPT_DEFAULT);
+  cmark_node *spoiler = cmark_node_first_child(doc);
+  cmark_node *code = cmark_node_next(spoiler);
+  cmark_node *para = cmark_node_next(code);
+  cmark_node *text = cmark_node_first_child(para);
+  cmark_node *link = cmark_node_next(text);
+  cmark_node *autolink = cmark_node_next(cmark_node_next(link));
+  cmark_node *reflink = cmark_node_next(cmark_node_next(autolink));
+  const char *str;
+  size_t len;
+
+  str = cmark_node_get_title_n(spoiler, &len);
+  OK(runner, len == 5 && memcmp(str, "Title", 5) == 0, "get_title_n spoiler");
+  str = cmark_node_get_fence_info_n(code, &len);
+  OK(runner, len == 4 && memcmp(str, "rust", 4) == 0, "get_fence_info_n");
+  str = cmark_node_get_literal_n(code, &len);
+  OK(runner, len == 5 && memcmp(str, "code\n", 5) == 0, "get_literal_n code");
+  str = cmark_node_get_literal_n(text, &len);
+  OK(runner, len == 2 && memcmp(str, "a ", 2) == 0, "get_literal_n text");
+  str = cmark_node_get_url_n(link, &len);
+  OK(runner, len == 2 && memcmp(str, "/u", 2) == 0, "get_url_n");
+  str = cmark_node_get_title_n(link, &len);
+  OK(runner, len == 1 && memcmp(str, "t", 1) == 0, "get_title_n");
+  str = cmark_node_get_url_n(autolink, &len);
+  OK(runner, len == 10 && memcmp(str, "http://x.y", 10) == 0,
+     "get_url_n autolink");
+  str = cmark_node_get_title_n(autolink, &len);
+  OK(runner, len == 0 && str[0] == '\0', "get_title_n empty");
+  str = cmark_node_get_url_n(reflink, &len);
+  OK(runner, len == 4 && memcmp(str, "/ref", 4) == 0, "get_url_n reference");
+  OK(runner, cmark_node_get_url_n(text, &len) == NULL, "get_url_n text");
+  OK(runner, cmark_node_get_literal_n(link, &len) == NULL,
+     "get_literal_n link");
+
+  OK(runner, cmark_node_set_literal_n(text, "xyz", 2), "set_literal_n");
+  str = cmark_node_get_literal_n(text, &len);
+  OK(runner, len == 2 && strcmp(str, "xy") == 0, "set_literal_n terminated");
+  OK(runner, cmark_node_set_url_n(link, "/abc", 3), "set_url_n");
+  STR_EQ(runner, cmark_node_get_url(link), "/ab", "set_url_n url");
+  OK(runner, cmark_node_set_title_n(link, NULL, 0), "set_title_n");
+  str = cmark_node_get_title_n(link, &len);
+  OK(runner, len == 0 && str[0] == '\0', "set_title_n cleared");
+  OK(runner, cmark_node_set_fence_info_n(code, "c++ x", 3),
+     "set_fence_info_n");
+  STR_EQ(runner, cmark_node_get_fence_info(code), "c++",
+         "set_fence_info_n info");
+  OK(runner, !cmark_node_set_url_n(text, "/u", 2), "set_url_n text");
+  OK(runner, cmark_node_set_title(link, "long title"), "set_title");
+  cmark_node_get_title_n(link, &len);
+  INT_EQ(runner, (int)len, 10, "set_title length");
+
+  cmark_node_free(doc);
+}
+
+static void parse_cache(test_batch_runner *runner) {
+  static const char a[] = "Cross *posted*\n";
+  static const char b[] = "Another post\n";
+  cmark_cache *cache = cmark_cache_new(1 << 20);
+  cmark_node *doc1, *doc2, *doc3, *doc4;
+  size_t size_a, size_b;
+  char *out;
+
+  doc1 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  doc2 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  OK(runner, doc1 == doc2, "cache_hit");
+  doc3 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_SMART);
+  OK(runner, doc3 != doc1, "cache_options_key");
+  doc4 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_LAZY_INLINES);
+  OK(runner, doc4 == doc1, "cache_ignores_lazy_inlines");
+  out = cmark_render_commonmark(doc1, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, "Cross *posted*\n", "cache_document");
+  free(out);
+  OK(runner, cmark_cache_get_size(cache) > 2 * sizeof(a), "cache_size");
+  cmark_cache_release(cache, doc1);
+  cmark_cache_release(cache, doc2);
+  cmark_cache_release(cache, doc3);
+  cmark_cache_release(cache, doc4);
+
+  // Released documents stay cached.
+  doc2 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  OK(runner, doc2 == doc1, "cache_hit_after_release");
+  cmark_cache_release(cache, doc2);
+  cmark_cache_free(cache);
+
+  // A cache too small for anything still hands out documents.
+  cache = cmark_cache_new(0);
+  doc1 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  doc2 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  OK(runner, doc1 != doc2, "cache_uncached");
+  INT_EQ(runner, (int)cmark_cache_get_size(cache), 0, "cache_uncached_size");
+  cmark_cache_release(cache, doc1);
+  cmark_cache_release(cache, doc2);
+  cmark_cache_free(cache);
+
+  // Evicted documents stay valid until released.
+  cache = cmark_cache_new(1 << 20);
+  doc1 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  size_a = cmark_cache_get_size(cache);
+  doc2 = cmark_cache_parse(cache, b, sizeof(b) - 1, CMARK_OPT_DEFAULT);
+  size_b = cmark_cache_get_size(cache) - size_a;
+  cmark_cache_release(cache, doc1);
+  cmark_cache_release(cache, doc2);
+  cmark_cache_free(cache);
+
+  cache = cmark_cache_new(size_a > size_b ? size_a : size_b);
+  doc1 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  doc2 = cmark_cache_parse(cache, b, sizeof(b) - 1, CMARK_OPT_DEFAULT);
+  INT_EQ(runner, (int)cmark_cache_get_size(cache), (int)size_b,
+         "cache_evicted_size");
+  out = cmark_render_commonmark(doc1, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, "Cross *posted*\n", "cache_evicted_document");
+  free(out);
+  cmark_cache_release(cache, doc1);
+  doc3 = cmark_cache_parse(cache, a, sizeof(a) - 1, CMARK_OPT_DEFAULT);
+  INT_EQ(runner, (int)cmark_cache_get_size(cache), (int)size_a,
+         "cache_lru_size");
+  cmark_cache_release(cache, doc2);
+  cmark_cache_release(cache, doc3);
+  cmark_cache_free(cache);
+}
+
+static void node_hashes(test_batch_runner *runner) {
+  static const char markdown[] = "same *x* [l](/u)\n"
+                                 "\n"
+                                 "same *x* [l](/u)\n"
+                                 "\n"
+                                 "- item\n";
+  static const char spaced[] = "same *x* [l](/u)\n"
+                               "\n\n\n"
+                               "same *x* [l](/u)\n"
+                               "\n"
+                               "-   item\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_NODE_HASHES);
+  cmark_node *other = cmark_parse_document(spaced, sizeof(spaced) - 1,
+                                           CMARK_OPT_SOURCEPOS);
+  cmark_node *lazy = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                          CMARK_OPT_LAZY_INLINES);
+  cmark_node *para1 = cmark_node_first_child(doc);
+  cmark_node *para2 = cmark_node_next(para1);
+  cmark_node *text = cmark_node_first_child(para1);
+  uint64_t hash = cmark_node_get_hash(doc);
+
+  OK(runner, hash != 0, "hash_nonzero");
+  OK(runner, cmark_node_get_hash(other) == hash, "hash_ignores_positions");
+  OK(runner, cmark_node_get_hash(lazy) == hash, "hash_lazy_inlines");
+  OK(runner, cmark_node_get_hash(para1) == cmark_node_get_hash(para2),
+     "hash_equal_subtrees");
+  OK(runner, cmark_node_get_hash(para1) != cmark_node_get_hash(text),
+     "hash_distinct_subtrees");
+
+  cmark_node_set_literal(text, "changed ");
+  OK(runner, cmark_node_get_hash(doc) != hash, "hash_setter_invalidates");
+  OK(runner, cmark_node_get_hash(para1) != cmark_node_get_hash(para2),
+     "hash_changed_subtree");
+  cmark_node_set_literal(text, "same ");
+  OK(runner, cmark_node_get_hash(doc) == hash, "hash_setter_restored");
+
+  cmark_node_unlink(para2);
+  OK(runner, cmark_node_get_hash(doc) != hash, "hash_unlink_invalidates");
+  cmark_node_insert_after(para1, para2);
+  OK(runner, cmark_node_get_hash(doc) == hash, "hash_insert_restored");
+
+  cmark_node_set_url(cmark_node_last_child(para2), "/v");
+  OK(runner, cmark_node_get_hash(doc) != hash, "hash_url");
+  OK(runner, cmark_node_get_hash(NULL) == 0, "hash_null");
+
+  cmark_node_free(doc);
+  cmark_node_free(other);
+  cmark_node_free(lazy);
+}
+
+static void node_diff(test_batch_runner *runner) {
+  static const char before[] = "# Title\n"
+                               "\n"
+                               "keep\n"
+                               "\n"
+                               "change *me*\n"
+                               "\n"
+                               "drop\n";
+  static const char after[] = "## Title\n"
+                              "\n"
+                              "keep\n"
+                              "\n"
+                              "change *you*\n"
+                              "\n"
+                              "> quote\n"
+                              "\n"
+                              "add\n";
+  cmark_node *a = cmark_parse_document(before, sizeof(before) - 1,
+                                       CMARK_OPT_DEFAULT);
+  cmark_node *b = cmark_parse_document(after, sizeof(after) - 1,
+                                       CMARK_OPT_LAZY_INLINES);
+  cmark_node *same = cmark_parse_document(before, sizeof(before) - 1,
+                                          CMARK_OPT_SOURCEPOS);
+  cmark_diff *diff = cmark_node_diff(a, b);
+
+  INT_EQ(runner, (int)cmark_diff_get_length(diff), 5, "diff_length");
+  INT_EQ(runner, cmark_diff_get_op(diff, 0), CMARK_DIFF_UPDATE,
+         "diff_heading_op");
+  OK(runner, cmark_diff_get_old(diff, 0) == cmark_node_first_child(a),
+     "diff_heading_old");
+  OK(runner, cmark_diff_get_new(diff, 0) == cmark_node_first_child(b),
+     "diff_heading_new");
+  INT_EQ(runner, cmark_diff_get_op(diff, 1), CMARK_DIFF_UPDATE,
+         "diff_text_op");
+  STR_EQ(runner, cmark_node_get_literal(cmark_diff_get_old(diff, 1)), "me",
+         "diff_text_old");
+  STR_EQ(runner, cmark_node_get_literal(cmark_diff_get_new(diff, 1)), "you",
+         "diff_text_new");
+  INT_EQ(runner, cmark_diff_get_op(diff, 2), CMARK_DIFF_DELETE,
+         "diff_delete_op");
+  OK(runner, cmark_diff_get_old(diff, 2) == cmark_node_last_child(a),
+     "diff_delete_old");
+  OK(runner, cmark_diff_get_new(diff, 2) == NULL, "diff_delete_new");
+  INT_EQ(runner, cmark_diff_get_op(diff, 3), CMARK_DIFF_INSERT,
+         "diff_insert_op");
+  INT_EQ(runner, cmark_node_get_type(cmark_diff_get_new(diff, 3)),
+         CMARK_NODE_BLOCK_QUOTE, "diff_insert_type");
+  OK(runner, cmark_diff_get_old(diff, 3) == NULL, "diff_insert_old");
+  OK(runner, cmark_diff_get_new(diff, 4) == cmark_node_last_child(b),
+     "diff_insert_last");
+  INT_EQ(runner, cmark_diff_get_op(diff, 5), 0, "diff_out_of_range");
+  cmark_diff_free(diff);
+
+  diff = cmark_node_diff(a, same);
+  INT_EQ(runner, (int)cmark_diff_get_length(diff), 0, "diff_equal_trees");
+  cmark_diff_free(diff);
+
+  diff = cmark_node_diff(a, cmark_node_first_child(b));
+  INT_EQ(runner, (int)cmark_diff_get_length(diff), 2, "diff_type_change");
+  INT_EQ(runner, cmark_diff_get_op(diff, 0), CMARK_DIFF_DELETE,
+         "diff_type_change_delete");
+  INT_EQ(runner, cmark_diff_get_op(diff, 1), CMARK_DIFF_INSERT,
+         "diff_type_change_insert");
+  cmark_diff_free(diff);
+
+  diff = cmark_node_diff(NULL, b);
+  INT_EQ(runner, cmark_diff_get_op(diff, 0), CMARK_DIFF_INSERT,
+         "diff_null_old");
+  cmark_diff_free(diff);
+
+  cmark_node_free(a);
+  cmark_node_free(b);
+  cmark_node_free(same);
+}
+
+static void retain_source(test_batch_runner *runner) {
+  static const char markdown[] = "Some   *odd*  text\n"
+                                 "\n"
+                                 "* star\n"
+                                 "* list\n"
+                                 "\n"
+                                 "see [ref]\n"
+                                 "\n"
+                                 "[ref]: /x\n"
+                                 "\n"
+                                 "[inline](/u)\n";
+  static const char unclosed[] = "- ```\n"
+                                 "  code\n"
+                                 "next\n";
+#ifndef CMARK_LEAN_NODES
+  static const char closed[] = "- ```\n"
+                               "  code\n"
+                               "  ```\n"
+                               "next\n";
+#endif
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_RETAIN_SOURCE);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *list = cmark_node_next(para);
+  cmark_node *link = cmark_node_first_child(cmark_node_last_child(doc));
+  char *out;
+
+#ifndef CMARK_LEAN_NODES
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "Some   *odd*  text\n"
+         "\n"
+         "* star\n"
+         "* list\n"
+         "\n"
+         "see [ref](/x)\n"
+         "\n"
+         "[inline](/u)\n",
+         "retain_source_unchanged");
+  free(out);
+#endif
+
+  cmark_node_set_url(link, "/v");
+#ifndef CMARK_LEAN_NODES
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "Some   *odd*  text\n"
+         "\n"
+         "* star\n"
+         "* list\n"
+         "\n"
+         "see [ref](/x)\n"
+         "\n"
+         "[inline](/v)\n",
+         "retain_source_edited_link");
+  free(out);
+#endif
+
+  cmark_node_set_literal(cmark_node_first_child(cmark_node_first_child(
+                             cmark_node_first_child(list))),
+                         "sun");
+  cmark_node_unlink(para);
+  cmark_node_append_child(doc, para);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "  - sun\n"
+         "  - list\n"
+         "\n"
+         "see [ref](/x)\n"
+         "\n"
+         "[inline](/v)\n"
+         "\n"
+         "Some   *odd*  text\n",
+         "retain_source_edited_list");
+  free(out);
+
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 72);
+  STR_EQ(runner, out,
+         "  - sun\n"
+         "  - list\n"
+         "\n"
+         "see [ref](/x)\n"
+         "\n"
+         "[inline](/v)\n"
+         "\n"
+         "Some *odd* text\n",
+         "retain_source_width");
+  free(out);
+
+  cmark_node_free(doc);
+
+  // A fence ended by its list item has no closing fence to copy, and the
+  // text after the copy would run into the code.
+  doc = cmark_parse_document(unclosed, sizeof(unclosed) - 1,
+                             CMARK_OPT_RETAIN_SOURCE);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  cmark_node_free(doc);
+  doc = cmark_parse_document(out, strlen(out), CMARK_OPT_DEFAULT);
+  STR_EQ(runner,
+         cmark_node_get_literal(cmark_node_first_child(
+             cmark_node_first_child(cmark_node_first_child(doc)))),
+         "code\n", "retain_source_unclosed_fence");
+  free(out);
+  cmark_node_free(doc);
+
+#ifndef CMARK_LEAN_NODES
+  doc = cmark_parse_document(closed, sizeof(closed) - 1,
+                             CMARK_OPT_RETAIN_SOURCE);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, "- ```\n  code\n  ```\n\nnext\n",
+         "retain_source_closed_fence");
+  free(out);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document("::: spoiler t\nabc   *x*\n:::\n", 28,
+                             CMARK_OPT_RETAIN_SOURCE);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, "::: spoiler t\nabc   *x*\n:::\n",
+         "retain_source_closed_spoiler");
+  free(out);
+  cmark_node_free(doc);
+#endif
+
+  // Likewise for a spoiler ended by the end of the input.
+  doc = cmark_parse_document("::: spoiler t\nabc\n", 18,
+                             CMARK_OPT_RETAIN_SOURCE);
+  para = cmark_node_new(CMARK_NODE_PARAGRAPH);
+  cmark_node_append_child(para, cmark_node_new(CMARK_NODE_TEXT));
+  cmark_node_set_literal(cmark_node_first_child(para), "appended");
+  cmark_node_append_child(doc, para);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  cmark_node_free(doc);
+  doc = cmark_parse_document(out, strlen(out), CMARK_OPT_DEFAULT);
+  INT_EQ(runner, cmark_node_get_type(cmark_node_last_child(doc)),
+         CMARK_NODE_PARAGRAPH, "retain_source_unclosed_spoiler");
+  free(out);
+  cmark_node_free(doc);
+}
+
+static void node_clone(test_batch_runner *runner) {
+  static const char markdown[] = "# Title\n"
+                                 "\n"
+                                 "[link](/u \"t\") *a* `b`\n"
+                                 "\n"
+                                 "``` info\n"
+                                 "code\n"
+                                 "```\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *copy = cmark_node_clone(doc);
+  cmark_node *link = cmark_node_first_child(cmark_node_next(
+      cmark_node_first_child(doc)));
+  cmark_node *copy_link = cmark_node_first_child(cmark_node_next(
+      cmark_node_first_child(copy)));
+  cmark_node *sub;
+  char *expected = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  char *out;
+
+  OK(runner, copy != doc &&
+                 cmark_node_parent(copy_link) != cmark_node_parent(link),
+     "clone_distinct_nodes");
+  OK(runner, cmark_node_get_hash(copy) == cmark_node_get_hash(doc),
+     "clone_hash");
+  OK(runner, cmark_node_get_url(copy_link) == cmark_node_get_url(link),
+     "clone_shares_strings");
+  out = cmark_render_commonmark(copy, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, expected, "clone_render");
+  free(out);
+
+  cmark_node_set_url(copy_link, "/v");
+  STR_EQ(runner, cmark_node_get_url(link), "/u", "clone_original_url");
+  STR_EQ(runner, cmark_node_get_url(copy_link), "/v", "clone_copy_url");
+  STR_EQ(runner, cmark_node_get_title(copy_link), "t", "clone_copy_title");
+  sub = cmark_node_new(CMARK_NODE_TEXT);
+  cmark_node_set_literal(sub, "x");
+  cmark_node_insert_after(cmark_node_next(copy_link), sub);
+  cmark_consolidate_text_nodes(copy);
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_next(copy_link)), " x",
+         "clone_consolidate");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_next(link)), " ",
+         "clone_consolidate_original");
+  cmark_node_free(copy);
+
+  sub = cmark_node_clone(link);
+  OK(runner, cmark_node_parent(sub) == NULL && cmark_node_next(sub) == NULL,
+     "clone_subtree_detached");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(sub)), "link",
+         "clone_subtree_child");
+  cmark_node_free(sub);
+
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, expected, "clone_original_intact");
+  free(out);
+  free(expected);
+  OK(runner, cmark_node_clone(NULL) == NULL, "clone_null");
+
+  cmark_node_free(doc);
+}
+
+static int count_filtered(cmark_node *root, uint32_t type_mask,
+                          cmark_node_type type, int *visited) {
+  cmark_iter *iter = cmark_iter_new_filtered(root, type_mask);
+  cmark_event_type ev_type;
+  int found = 0;
+
+  *visited = 0;
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    if (ev_type == CMARK_EVENT_ENTER) {
+      (*visited)++;
+      if (cmark_node_get_type(cmark_iter_get_node(iter)) == type) {
+        found++;
+      }
+    }
+  }
+  cmark_iter_free(iter);
+  return found;
+}
+
+static void iter_filtered(test_batch_runner *runner) {
+  static const char markdown[] = "Plain *text* here.\n"
+                                 "\n"
+                                 "- item\n"
+                                 "- ![a](a.png) and [l](/u)\n"
+                                 "\n"
+                                 "```\n"
+                                 "code\n"
+                                 "```\n"
+                                 "\n"
+                                 "> ![b](b.png)\n";
+  uint32_t images = CMARK_NODE_MASK(CMARK_NODE_IMAGE);
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *lazy = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                          CMARK_OPT_LAZY_INLINES);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *image;
+  int visited;
+
+  INT_EQ(runner, count_filtered(doc, images, CMARK_NODE_IMAGE, &visited), 2,
+         "filtered_images");
+  // Document, list, item, paragraph, image; block quote, paragraph, image.
+  INT_EQ(runner, visited, 8, "filtered_visited");
+  // Blocks with deferred inlines are entered to find out.
+  INT_EQ(runner, count_filtered(lazy, images, CMARK_NODE_IMAGE, &visited), 2,
+         "filtered_lazy_images");
+  INT_EQ(runner,
+         count_filtered(doc,
+                        CMARK_NODE_MASK(CMARK_NODE_LINK) |
+                            CMARK_NODE_MASK(CMARK_NODE_CODE_BLOCK),
+                        CMARK_NODE_LINK, &visited),
+         1, "filtered_links");
+  INT_EQ(runner, visited, 6, "filtered_links_visited");
+  INT_EQ(runner, count_filtered(doc, 0, CMARK_NODE_IMAGE, &visited), 2,
+         "filtered_unfiltered");
+
+  image = cmark_node_new(CMARK_NODE_IMAGE);
+  cmark_node_append_child(para, image);
+  INT_EQ(runner, count_filtered(doc, images, CMARK_NODE_IMAGE, &visited), 3,
+         "filtered_appended");
+  cmark_node_free(image);
+  INT_EQ(runner, count_filtered(doc, images, CMARK_NODE_IMAGE, &visited), 2,
+         "filtered_unlinked");
+
+  cmark_node_free(doc);
+  cmark_node_free(lazy);
+}
+
+static const char *proxy_url(cmark_node *node, const char *url, void *data) {
+  static char buf[64];
+
+  (*(int *)data)++;
+  if (cmark_node_get_type(node) != CMARK_NODE_IMAGE) {
+    return strcmp(url, "/same") == 0 ? url : NULL;
+  }
+  snprintf(buf, sizeof(buf), "https://proxy/?u=%s", url);
+  return buf;
+}
+
+static void rewrite_urls(test_batch_runner *runner) {
+  static const char markdown[] = "![a](a.png) [l](/same)\n"
+                                 "\n"
+                                 "Plain text.\n"
+                                 "\n"
+                                 "> [m](/u) ![b](b.png \"t\")\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *first = cmark_node_first_child(cmark_node_first_child(doc));
+  cmark_node *copy, *image;
+  int calls = 0;
+  char *out;
+
+  INT_EQ(runner, cmark_node_rewrite_urls(doc, proxy_url, &calls), 2,
+         "rewrite_count");
+  INT_EQ(runner, calls, 4, "rewrite_calls");
+  STR_EQ(runner, cmark_node_get_url(first), "https://proxy/?u=a.png",
+         "rewrite_url");
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "![a](https://proxy/?u=a.png) [l](/same)\n"
+         "\n"
+         "Plain text.\n"
+         "\n"
+         "> [m](/u) ![b](https://proxy/?u=b.png \"t\")\n",
+         "rewrite_render");
+  free(out);
+
+  // Rewriting again replaces URLs already stored with the document.
+  calls = 0;
+  INT_EQ(runner, cmark_node_rewrite_urls(first, proxy_url, &calls), 1,
+         "rewrite_again");
+  STR_EQ(runner, cmark_node_get_url(first),
+         "https://proxy/?u=https://proxy/?u=a.png", "rewrite_again_url");
+  cmark_node_set_url(first, "c.png");
+  STR_EQ(runner, cmark_node_get_url(first), "c.png", "rewrite_set_url");
+
+  copy = cmark_node_clone(doc);
+  INT_EQ(runner, cmark_node_rewrite_urls(copy, proxy_url, &calls), 2,
+         "rewrite_clone");
+  STR_EQ(runner, cmark_node_get_url(first), "c.png", "rewrite_clone_original");
+  cmark_node_free(copy);
+
+  // Detached nodes have their URLs set one by one.
+  image = cmark_node_new(CMARK_NODE_IMAGE);
+  cmark_node_set_url(image, "d.png");
+  INT_EQ(runner, cmark_node_rewrite_urls(image, proxy_url, &calls), 1,
+         "rewrite_detached");
+  STR_EQ(runner, cmark_node_get_url(image), "https://proxy/?u=d.png",
+         "rewrite_detached_url");
+  cmark_node_free(image);
+  INT_EQ(runner, cmark_node_rewrite_urls(doc, NULL, NULL), 0,
+         "rewrite_no_rewriter");
+
+  cmark_node_free(doc);
+}
+
+static void document_summary(test_batch_runner *runner) {
+  static const char markdown[] = "# A *title*\n"
+                                 "\n"
+                                 "Some foo\\*bar text with [a link](/u),\n"
+                                 "<http://auto> and ![alt text](one.png).\n"
+                                 "\n"
+                                 "::: spoiler Title\n"
+                                 "`code span` ![b](two.png)\n"
+                                 ":::\n"
+                                 "\n"
+                                 "```\n"
+                                 "int x;\n"
+                                 "```\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DOCUMENT_SUMMARY |
+                                             CMARK_OPT_LAZY_INLINES);
+  const cmark_document_summary *summary = cmark_document_get_summary(doc);
+  cmark_node *copy;
+
+  OK(runner, summary != NULL, "summary_present");
+  // A title, Some foo*bar text with a link, http://auto and alt text,
+  // code span b, int x;
+  INT_EQ(runner, (int)summary->words, 17, "summary_words");
+  INT_EQ(runner, (int)summary->reading_time, 6, "summary_reading_time");
+  INT_EQ(runner, (int)summary->links, 2, "summary_links");
+  INT_EQ(runner, (int)summary->images, 2, "summary_images");
+  STR_EQ(runner, summary->first_image_url, "one.png", "summary_first_image");
+  OK(runner, summary->has_links && summary->has_spoilers && summary->has_code,
+     "summary_flags");
+  OK(runner,
+     cmark_node_first_child(cmark_node_first_child(doc)) != NULL,
+     "summary_parses_inlines");
+
+  copy = cmark_node_clone(doc);
+  summary = cmark_document_get_summary(copy);
+  OK(runner, summary && summary != cmark_document_get_summary(doc),
+     "summary_clone");
+  STR_EQ(runner, summary->first_image_url, "one.png",
+         "summary_clone_first_image");
+  cmark_node_free(copy);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document("Plain\n", 6, CMARK_OPT_DOCUMENT_SUMMARY);
+  summary = cmark_document_get_summary(doc);
+  OK(runner,
+     summary->words == 1 && summary->first_image_url == NULL &&
+         !summary->has_links && !summary->has_spoilers && !summary->has_code,
+     "summary_plain");
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document("Plain\n", 6, CMARK_OPT_DEFAULT);
+  OK(runner, cmark_document_get_summary(doc) == NULL, "summary_absent");
+  OK(runner, cmark_document_get_summary(cmark_node_first_child(doc)) == NULL,
+     "summary_not_document");
+  cmark_node_free(doc);
+}
+
+static void mentions(test_batch_runner *runner) {
+  static const char markdown[] =
+      "Hi @alice@lemmy.ml, see !rust_lang@programming.dev.\n"
+      "Mail bob@example.com, not @nobody or @bad@host.\n";
+  static const char in_link[] = "[hi @a@b.com and !c@d.org](/x)\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_MENTIONS);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *user = cmark_node_next(cmark_node_first_child(para));
+  cmark_node *community = cmark_node_next(cmark_node_next(user));
+  const char *name, *instance;
+  size_t name_len, instance_len;
+  int links = 0;
+  cmark_iter *iter;
+  char *out;
+
+  INT_EQ(runner, cmark_node_get_type(user), CMARK_NODE_LINK, "mention_link");
+  STR_EQ(runner, cmark_node_get_url(user), "/u/alice@lemmy.ml",
+         "mention_user_url");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(user)),
+         "@alice@lemmy.ml", "mention_user_text");
+  INT_EQ(runner,
+         cmark_node_get_mention(user, &name, &name_len, &instance,
+                                &instance_len),
+         CMARK_USER_MENTION, "mention_user_type");
+  OK(runner,
+     name_len == 5 && strncmp(name, "alice", 5) == 0 && instance_len == 8 &&
+         strncmp(instance, "lemmy.ml", 8) == 0,
+     "mention_user_parts");
+  STR_EQ(runner, cmark_node_get_url(community),
+         "/c/rust_lang@programming.dev", "mention_community_url");
+  INT_EQ(runner,
+         cmark_node_get_mention(community, NULL, NULL, NULL, NULL),
+         CMARK_COMMUNITY_MENTION, "mention_community_type");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_next(community)), ".",
+         "mention_trailing_dot");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_last_child(para)),
+         "Mail bob@example.com, not @nobody or @bad@host.",
+         "mention_not_matched");
+#ifndef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_start_column(community), 25,
+         "mention_start_column");
+  INT_EQ(runner, cmark_node_get_end_column(community), 50,
+         "mention_end_column");
+#endif
+
+  iter = cmark_iter_new(doc);
+  while (cmark_iter_next(iter) != CMARK_EVENT_DONE) {
+    if (cmark_iter_get_event_type(iter) == CMARK_EVENT_ENTER &&
+        cmark_node_get_type(cmark_iter_get_node(iter)) == CMARK_NODE_LINK) {
+      links++;
+    }
+  }
+  cmark_iter_free(iter);
+  INT_EQ(runner, links, 2, "mention_count");
+
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "Hi @alice@lemmy.ml, see !rust_lang@programming.dev.\n"
+         "Mail bob@example.com, not @nobody or @bad@host.\n",
+         "mention_render");
+  free(out);
+
+  cmark_node_set_url(user, "https://lemmy.ml/u/alice");
+  INT_EQ(runner, cmark_node_get_mention(user, NULL, NULL, NULL, NULL),
+         CMARK_NO_MENTION, "mention_set_url");
+  INT_EQ(runner, cmark_node_get_mention(para, NULL, NULL, NULL, NULL),
+         CMARK_NO_MENTION, "mention_not_link");
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  para = cmark_node_first_child(doc);
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(para)),
+         "Hi @alice@lemmy.ml, see !rust_lang@programming.dev.",
+         "mention_opt_in");
+  cmark_node_free(doc);
+
+  // Links can't contain links, so mentions in link text stay text.
+  doc = cmark_parse_document(in_link, sizeof(in_link) - 1,
+                             CMARK_OPT_MENTIONS | CMARK_OPT_DOCUMENT_SUMMARY);
+  user = cmark_node_first_child(cmark_node_first_child(doc));
+  STR_EQ(runner, cmark_node_get_url(user), "/x", "mention_in_link");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(user)),
+         "hi @a@b.com and !c@d.org", "mention_in_link_text");
+  OK(runner, cmark_node_first_child(user) == cmark_node_last_child(user),
+     "mention_in_link_single");
+  INT_EQ(runner, (int)cmark_document_get_summary(doc)->links, 1,
+         "mention_in_link_summary");
+  cmark_node_free(doc);
+}
+
+// Builds 'count' copies of 'unit' followed by 'tail'.
+static char *repeat_markdown(const char *unit, int count, const char *tail,
+                             size_t *len) {
+  size_t unit_len = strlen(unit), tail_len = strlen(tail);
+  char *buf = (char *)calloc(unit_len * count + tail_len + 1, 1);
+  int i;
+
+  for (i = 0; i < count; i++) {
+    memcpy(buf + unit_len * i, unit, unit_len);
+  }
+  memcpy(buf + unit_len * count, tail, tail_len);
+  *len = unit_len * count + tail_len;
+  return buf;
+}
+
+static void bare_urls(test_batch_runner *runner) {
+  static const char markdown[] =
+      "See https://example.com/a_b?q=1&amp;x=2. and\n"
+      "(www.commonmark.org/help) or **http://a.io/x**, "
+      "but not xhttp://a.io, https://a_b.io or www.\n";
+  static const char bracketed[] =
+      "[mirror https://a.com/x](https://b.com/y), see [docs at "
+      "www.example.com](/x) and [at www.c.io]\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_AUTOLINK_URLS);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *link = cmark_node_next(cmark_node_first_child(para));
+  char *out, *input;
+  size_t len;
+
+  INT_EQ(runner, cmark_node_get_type(link), CMARK_NODE_LINK, "bare_url_link");
+  STR_EQ(runner, cmark_node_get_url(link), "https://example.com/a_b?q=1&x=2",
+         "bare_url_url");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(link)),
+         "https://example.com/a_b?q=1&x=2", "bare_url_text");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_next(link)), ". and",
+         "bare_url_trailing_punctuation");
+#ifndef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_start_column(link), 5,
+         "bare_url_start_column");
+  INT_EQ(runner, cmark_node_get_end_column(link), 39, "bare_url_end_column");
+#endif
+
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "See <https://example.com/a_b?q=1&x=2>. and\n"
+         "([www.commonmark.org/help](http://www.commonmark.org/help)) or "
+         "**<http://a.io/x>**, but not xhttp://a.io, https://a\\_b.io or "
+         "www.\n",
+         "bare_url_render");
+  free(out);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  para = cmark_node_first_child(doc);
+  INT_EQ(runner, cmark_node_get_type(cmark_node_first_child(para)),
+         CMARK_NODE_TEXT, "bare_url_opt_in");
+  OK(runner, cmark_node_next(cmark_node_first_child(para)) != NULL &&
+                 cmark_node_get_type(cmark_node_next(
+                     cmark_node_first_child(para))) == CMARK_NODE_SOFTBREAK,
+     "bare_url_opt_in_text");
+  cmark_node_free(doc);
+
+  // URLs stop at the end of bracketed text, and link text keeps its URLs
+  // as text.
+  doc = cmark_parse_document(bracketed, sizeof(bracketed) - 1,
+                             CMARK_OPT_AUTOLINK_URLS |
+                                 CMARK_OPT_DOCUMENT_SUMMARY);
+  para = cmark_node_first_child(doc);
+  link = cmark_node_first_child(para);
+  STR_EQ(runner, cmark_node_get_url(link), "https://b.com/y",
+         "bare_url_in_link");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(link)),
+         "mirror https://a.com/x", "bare_url_in_link_text");
+  OK(runner, cmark_node_first_child(link) == cmark_node_last_child(link),
+     "bare_url_in_link_single");
+  INT_EQ(runner, (int)cmark_document_get_summary(doc)->links, 3,
+         "bare_url_in_link_summary");
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out,
+         "[mirror https://a.com/x](https://b.com/y), see [docs at "
+         "www.example.com](/x) and \\[at [www.c.io](http://www.c.io)\\]\n",
+         "bare_url_in_brackets_render");
+  free(out);
+  cmark_node_free(doc);
+
+  // Each "www." can start a URL, but none of them has a valid domain.  A
+  // failed domain scan isn't repeated for candidates further into it.
+  input = repeat_markdown("_www.", 50000, "x_y", &len);
+  doc = cmark_parse_document(input, len, CMARK_OPT_AUTOLINK_URLS);
+  para = cmark_node_first_child(doc);
+  INT_EQ(runner, cmark_node_get_type(cmark_node_first_child(para)),
+         CMARK_NODE_TEXT, "bare_url_pathological");
+  OK(runner, cmark_node_first_child(para) == cmark_node_last_child(para),
+     "bare_url_pathological_single");
+  cmark_node_free(doc);
+  free(input);
+}
+
+static void script_spans(test_batch_runner *runner) {
+  static const char markdown[] = "2^10 and ^a\\^b^ c\n";
+  static const char nested[] = "~x~~~y~~ ^^a^^ ~~~s~~~\n";
+  static const char inlines[] =
+      "x^&amp;^ a^`c`^ ~[l](/u)~ ^`a^b`^ ~\\~`~`~\n";
+  // The first child each input yields, and the text it ends with when that
+  // isn't the first child.
+  static const struct {
+    const char *prefix, *suffix;
+    cmark_node_type first;
+    const char *last;
+  } pathological[] = {{"^a ", "", CMARK_NODE_TEXT, NULL},
+                      {"^", "a", CMARK_NODE_TEXT, NULL},
+                      {"~a", "~~", CMARK_NODE_SUB, "a~~"},
+                      {"~~a~", "", CMARK_NODE_STRIKE, "~a~"},
+                      {"\\^a", "^", CMARK_NODE_TEXT, NULL},
+                      {"^[a", "", CMARK_NODE_SUPER, "[a"},
+                      {"[x ", "^[a^ b", CMARK_NODE_TEXT, " b"}};
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *super = cmark_node_next(cmark_node_first_child(para));
+  char *out;
+  size_t i, len;
+
+  INT_EQ(runner, cmark_node_get_type(super), CMARK_NODE_SUPER,
+         "script_super");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(super)),
+         "a^b", "script_escaped_closer");
+#ifndef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_start_column(super), 10,
+         "script_start_column");
+  INT_EQ(runner, cmark_node_get_end_column(super), 15, "script_end_column");
+#endif
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(nested, sizeof(nested) - 1, CMARK_OPT_DEFAULT);
+  out = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, nested, "script_render");
+  free(out);
+  cmark_node_free(doc);
+
+  // Contents are parsed as inlines, and a closer inside a code span or
+  // after a backslash doesn't end the span.
+  doc = cmark_parse_document(inlines, sizeof(inlines) - 1, CMARK_OPT_DEFAULT);
+  para = cmark_node_first_child(doc);
+  super = cmark_node_next(cmark_node_first_child(para));
+  INT_EQ(runner, cmark_node_get_type(super), CMARK_NODE_SUPER,
+         "script_entity_super");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(super)), "&",
+         "script_entity");
+  super = cmark_node_next(cmark_node_next(super));
+  INT_EQ(runner, cmark_node_get_type(cmark_node_first_child(super)),
+         CMARK_NODE_CODE, "script_code");
+  super = cmark_node_next(cmark_node_next(super));
+  INT_EQ(runner, cmark_node_get_type(super), CMARK_NODE_SUB,
+         "script_link_sub");
+  STR_EQ(runner, cmark_node_get_url(cmark_node_first_child(super)), "/u",
+         "script_link");
+  super = cmark_node_next(cmark_node_next(super));
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(super)), "a^b",
+         "script_code_closer");
+  super = cmark_node_next(cmark_node_next(super));
+  INT_EQ(runner, cmark_node_get_type(super), CMARK_NODE_SUB,
+         "script_escape_sub");
+  STR_EQ(runner, cmark_node_get_literal(cmark_node_first_child(super)), "~",
+         "script_escape");
+  INT_EQ(runner, cmark_node_get_type(cmark_node_last_child(super)),
+         CMARK_NODE_CODE, "script_escape_code");
+  cmark_node_free(doc);
+
+  // Spans are found by scanning ahead to the next delimiter, so unclosed
+  // openers cost no more than the text they cover, and spans inside and
+  // around many open brackets stay linear.
+  for (i = 0; i < sizeof(pathological) / sizeof(pathological[0]); i++) {
+    char *input = repeat_markdown(pathological[i].prefix, 50000,
+                                  pathological[i].suffix, &len);
+    cmark_node *first, *last;
+
+    doc = cmark_parse_document(input, len, CMARK_OPT_DEFAULT);
+    first = cmark_node_first_child(cmark_node_first_child(doc));
+    last = cmark_node_last_child(cmark_node_first_child(doc));
+    INT_EQ(runner, cmark_node_get_type(first), pathological[i].first,
+           "script_pathological_first");
+    if (pathological[i].last == NULL) {
+      OK(runner, first == last, "script_pathological_single");
+    } else {
+      STR_EQ(runner, cmark_node_get_literal(last), pathological[i].last,
+             "script_pathological_last");
+    }
+    cmark_node_free(doc);
+    free(input);
+  }
+}
+
+static void render_layout(test_batch_runner *runner) {
+  static const char markdown[] = "a *b **c*** [`d` e](/f)\n"
+                                 "![\xc3\xa9\xf0\x9f\x98\x80](/g) ~h~\n"
+                                 "\n"
+                                 "    code\n";
+  static const uint16_t utf16[] = {'a', ' ', 'b', ' ', 'c', ' ',
+                                   'd', ' ', 'e', ' ', 0xE9, 0xD83D,
+                                   0xDE00, ' ', 'h', 0};
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_DEFAULT);
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_text_layout *layout = cmark_render_layout(para, CMARK_OPT_HARDBREAKS);
+
+  STR_EQ(runner, (const char *)layout->text,
+         "a b c d e\n\xc3\xa9\xf0\x9f\x98\x80 h", "layout_text");
+  INT_EQ(runner, (int)layout->length, 18, "layout_length");
+  INT_EQ(runner, (int)layout->num_runs, 10, "layout_num_runs");
+  INT_EQ(runner, (int)layout->runs[1].start, 2, "layout_emph_start");
+  INT_EQ(runner, (int)layout->runs[1].style, CMARK_STYLE_EMPH,
+         "layout_emph_style");
+  INT_EQ(runner, (int)layout->runs[2].style,
+         CMARK_STYLE_EMPH | CMARK_STYLE_STRONG, "layout_strong_style");
+  INT_EQ(runner, (int)layout->runs[4].style,
+         CMARK_STYLE_LINK | CMARK_STYLE_CODE, "layout_code_style");
+  INT_EQ(runner, (int)layout->runs[5].length, 2, "layout_link_length");
+  INT_EQ(runner, layout->runs[5].link, 0, "layout_link_index");
+  INT_EQ(runner, layout->runs[6].link, -1, "layout_break_link");
+  INT_EQ(runner, (int)layout->runs[7].style, CMARK_STYLE_IMAGE,
+         "layout_image_style");
+  INT_EQ(runner, (int)layout->runs[9].style, CMARK_STYLE_SUB,
+         "layout_sub_style");
+  INT_EQ(runner, (int)layout->num_urls, 2, "layout_num_urls");
+  STR_EQ(runner, layout->urls[0], "/f", "layout_link_url");
+  STR_EQ(runner, layout->urls[1], "/g", "layout_image_url");
+  free(layout);
+
+  layout = cmark_render_layout(para, CMARK_OPT_LAYOUT_UTF16);
+  INT_EQ(runner, (int)layout->length, 15, "layout_utf16_length");
+  OK(runner, memcmp(layout->text, utf16, sizeof(utf16)) == 0,
+     "layout_utf16_text");
+  INT_EQ(runner, (int)layout->runs[7].start, 10, "layout_utf16_start");
+  INT_EQ(runner, (int)layout->runs[7].length, 3, "layout_utf16_surrogates");
+  free(layout);
+
+  layout = cmark_render_layout(cmark_node_next(para), CMARK_OPT_DEFAULT);
+  STR_EQ(runner, (const char *)layout->text, "code", "layout_code_block");
+  INT_EQ(runner, (int)layout->num_runs, 1, "layout_code_block_runs");
+  free(layout);
+
+  OK(runner, cmark_render_layout(doc, CMARK_OPT_DEFAULT) == NULL,
+     "layout_not_leaf");
+  cmark_node_free(doc);
+}
+
+static void source_offsets(test_batch_runner *runner) {
+  static const char markdown[] = "\xef\xbb\xbf# h\xc3\xa9\r\n"
+                                 "\r\n"
+                                 "*\xf0\x9f\x98\x80* x\n";
+#ifndef CMARK_LEAN_NODES
+  static const char replaced[] = "x\0y\xff\xc3z *w*\n"
+                                 "\n"
+                                 "b\n";
+#endif
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_SOURCE_OFFSETS);
+  cmark_node *doc, *heading, *emph;
+  size_t i, offset = 0;
+
+  // Split inside the line endings and the emoji.
+  for (i = 0; i < sizeof(markdown) - 1; i += 3) {
+    size_t len = sizeof(markdown) - 1 - i < 3 ? sizeof(markdown) - 1 - i : 3;
+    cmark_parser_feed(parser, markdown + i, len);
+  }
+  doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+  heading = cmark_node_first_child(doc);
+  emph = cmark_node_first_child(cmark_node_next(heading));
+
+#ifndef CMARK_LEAN_NODES
+  OK(runner, cmark_document_get_byte_offset(doc, 1, 1, &offset),
+     "byte_offset_ok");
+  INT_EQ(runner, (int)offset, 3, "byte_offset_after_bom");
+  cmark_document_get_utf16_offset(doc, 1, 1, &offset);
+  INT_EQ(runner, (int)offset, 1, "utf16_offset_after_bom");
+  cmark_document_get_byte_offset(doc, 1, 6, &offset);
+  INT_EQ(runner, (int)offset, 8, "byte_offset_line_end");
+  cmark_document_get_utf16_offset(doc, 1, 6, &offset);
+  INT_EQ(runner, (int)offset, 5, "utf16_offset_line_end");
+  cmark_document_get_byte_offset(doc, 3, 1, &offset);
+  INT_EQ(runner, (int)offset, 12, "byte_offset_after_crlf");
+  cmark_document_get_utf16_offset(doc, 3, 1, &offset);
+  INT_EQ(runner, (int)offset, 9, "utf16_offset_after_crlf");
+  cmark_document_get_utf16_offset(doc, 3, 8, &offset);
+  INT_EQ(runner, (int)offset, 14, "utf16_offset_after_run");
+
+  cmark_document_get_byte_offset(doc, cmark_node_get_end_line(emph),
+                                 cmark_node_get_end_column(emph) + 1,
+                                 &offset);
+  INT_EQ(runner, (int)offset, 18, "byte_offset_node_end");
+  cmark_document_get_utf16_offset(doc, cmark_node_get_end_line(emph),
+                                  cmark_node_get_end_column(emph) + 1,
+                                  &offset);
+  INT_EQ(runner, (int)offset, 13, "utf16_offset_surrogate_pair");
+
+  OK(runner, !cmark_document_get_byte_offset(doc, 4, 1, &offset),
+     "byte_offset_past_last_line");
+  OK(runner, !cmark_document_get_utf16_offset(doc, 1, 7, &offset),
+     "utf16_offset_past_line_end");
+  OK(runner, !cmark_document_get_byte_offset(heading, 1, 1, &offset),
+     "byte_offset_not_document");
+#else
+  (void)heading;
+  (void)emph;
+  OK(runner, !cmark_document_get_byte_offset(doc, 1, 1, &offset),
+     "byte_offset_lean");
+#endif
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  OK(runner, !cmark_document_get_byte_offset(doc, 1, 1, &offset),
+     "byte_offset_opt_in");
+  cmark_node_free(doc);
+
+#ifndef CMARK_LEAN_NODES
+  // Each of the NUL byte, the stray byte and the cut-off sequence is
+  // parsed as the three bytes of U+FFFD.
+  doc = cmark_parse_document(replaced, sizeof(replaced) - 1,
+                             CMARK_OPT_SOURCE_OFFSETS |
+                                 CMARK_OPT_VALIDATE_UTF8);
+  emph = cmark_node_last_child(cmark_node_first_child(doc));
+  cmark_document_get_byte_offset(doc, 1, cmark_node_get_start_column(emph),
+                                 &offset);
+  INT_EQ(runner, (int)offset, 7, "byte_offset_after_replacements");
+  cmark_document_get_byte_offset(doc, 1, cmark_node_get_end_column(emph) + 1,
+                                 &offset);
+  INT_EQ(runner, (int)offset, 10, "byte_offset_replacements_line_end");
+  cmark_document_get_byte_offset(doc, 1, 3, &offset);
+  INT_EQ(runner, (int)offset, 1, "byte_offset_inside_replacement");
+  cmark_document_get_byte_offset(doc, 1, 5, &offset);
+  INT_EQ(runner, (int)offset, 2, "byte_offset_between_replacements");
+  cmark_document_get_byte_offset(doc, 3, 1, &offset);
+  INT_EQ(runner, (int)offset, 12, "byte_offset_line_after_replacements");
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(replaced, sizeof(replaced) - 1,
+                             CMARK_OPT_SOURCE_OFFSETS);
+  emph = cmark_node_last_child(cmark_node_first_child(doc));
+  cmark_document_get_byte_offset(doc, 1, cmark_node_get_start_column(emph),
+                                 &offset);
+  INT_EQ(runner, (int)offset, 7, "byte_offset_after_nul");
+  cmark_node_free(doc);
+#endif
+}
+
+static void feed_string(cmark_parser *parser, const char *text) {
+  cmark_parser_feed(parser, text, strlen(text));
+}
+
+static void progressive_blocks(test_batch_runner *runner) {
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_node *heading, *para, *quote, *tail, *doc;
+  char *cmark;
+
+  feed_string(parser, "# a");
+  OK(runner, cmark_parser_next_block(parser) == NULL, "next_block_open");
+
+  feed_string(parser, "\n\npara [x]\n");
+  heading = cmark_parser_next_block(parser);
+  INT_EQ(runner, cmark_node_get_type(heading), CMARK_NODE_HEADING,
+         "next_block_heading");
+  OK(runner, cmark_node_first_child(heading) == NULL,
+     "next_block_inlines_pending");
+  OK(runner, cmark_parser_next_block(parser) == NULL, "next_block_para_open");
+
+  feed_string(parser, "\n> [x]\n\n");
+  para = cmark_parser_next_block(parser);
+  quote = cmark_parser_next_block(parser);
+  INT_EQ(runner, cmark_node_get_type(para), CMARK_NODE_PARAGRAPH,
+         "next_block_para");
+  INT_EQ(runner, cmark_node_get_type(quote), CMARK_NODE_BLOCK_QUOTE,
+         "next_block_quote");
+  OK(runner, cmark_parser_next_block(parser) == NULL, "next_block_caught_up");
+
+  // Parsed before the definition arrives, so [x] stays text.
+  cmark_parser_parse_block_inlines(parser, quote);
+  INT_EQ(runner,
+         cmark_node_get_type(
+             cmark_node_first_child(cmark_node_first_child(quote))),
+         CMARK_NODE_TEXT, "parse_block_inlines");
+
+  feed_string(parser, "[x]: /u\n\ntail");
+  OK(runner, cmark_parser_next_block(parser) == NULL,
+     "next_block_definition");
+  doc = cmark_parser_finish(parser);
+  tail = cmark_parser_next_block(parser);
+  OK(runner, tail == cmark_node_last_child(doc), "next_block_after_finish");
+  OK(runner, cmark_parser_next_block(parser) == NULL, "next_block_done");
+  cmark_parser_free(parser);
+
+  OK(runner, cmark_node_first_child(doc) == heading &&
+                 cmark_node_next(heading) == para &&
+                 cmark_node_next(para) == quote &&
+                 cmark_node_next(quote) == tail,
+     "next_block_in_document");
+  cmark = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, cmark, "# a\n\npara [x](/u)\n\n> \\[x\\]\n\ntail\n",
+         "next_block_render");
+  free(cmark);
+  cmark_node_free(doc);
+
+  // Blocks past the preview limit are never handed out.
+  parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_parser_set_preview_limits(parser, 1, 0);
+  feed_string(parser, "a\n\nb\n\nc\n");
+  OK(runner, cmark_parser_next_block(parser) != NULL, "next_block_preview");
+  OK(runner, cmark_parser_next_block(parser) == NULL,
+     "next_block_preview_limit");
+  doc = cmark_parser_finish(parser);
+  OK(runner, cmark_parser_next_block(parser) == NULL,
+     "next_block_preview_dropped");
+  cmark_parser_free(parser);
+  cmark_node_free(doc);
+
+  // Words in a code block parsed early are counted once.
+  parser = cmark_parser_new(CMARK_OPT_DOCUMENT_SUMMARY);
+  feed_string(parser, "> ```\n> one two three\n> ```\n\npara four\n\n");
+  cmark_parser_parse_block_inlines(parser, cmark_parser_next_block(parser));
+  cmark_parser_parse_block_inlines(parser, cmark_parser_next_block(parser));
+  doc = cmark_parser_finish(parser);
+  INT_EQ(runner, (int)cmark_document_get_summary(doc)->words, 5,
+         "parse_block_inlines_words");
+  cmark_parser_free(parser);
+  cmark_node_free(doc);
+}
+
+static void borrowed_content(test_batch_runner *runner) {
+  // Paragraph lines that can and can't be borrowed from the input.
+  static const char markdown[] = "plain line\n"
+                                 "  indented\n"
+                                 "\ttabbed *emph*\n"
+                                 "> quoted\n"
+                                 "lazy\n"
+                                 "\n"
+                                 "[ref]: /url\n"
+                                 "see [ref]\n"
+                                 "Setext\n"
+                                 "===\n"
+                                 "crlf\r\n"
+                                 "line\n"
+                                 "nul \0 byte\n"
+                                 "::: spoiler title\n"
+                                 "hidden\n"
+                                 ":::\n"
+                                 "last";
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_node *doc;
+  char *whole, *fed;
+
+  for (size_t i = 0; i < sizeof(markdown) - 1; i++) {
+    cmark_parser_feed(parser, markdown + i, 1);
+  }
+  doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+  fed = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_DEFAULT);
+  whole = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, whole, fed, "borrowed_content");
+#ifndef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_end_column(cmark_node_last_child(doc)), 4,
+         "borrowed_content_end_column");
+#endif
+  free(whole);
+  free(fed);
+  cmark_node_free(doc);
+
+  // Paragraphs past a preview limit are freed before their inlines are
+  // parsed.
+  doc = cmark_parse_document_preview(markdown, sizeof(markdown) - 1,
+                                     CMARK_OPT_DEFAULT, 2, 0);
+  whole = cmark_render_commonmark(doc, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, whole,
+         "plain line\nindented\ntabbed *emph*\n\n> quoted\n> lazy\n",
+         "borrowed_content_preview");
+  free(whole);
+  cmark_node_free(doc);
+}
+
+static int lean_allocs;
+
+// Blocks start past a header, so passing one to the default allocator's
+// free() crashes.
+#define LEAN_HEADER 16
+
+static void *lean_calloc(size_t nmem, size_t size) {
+  unsigned char *block = (unsigned char *)calloc(1, LEAN_HEADER + nmem * size);
+
+  lean_allocs++;
+  return block + LEAN_HEADER;
+}
+
+static void *lean_realloc(void *ptr, size_t size) {
+  unsigned char *block = ptr ? (unsigned char *)ptr - LEAN_HEADER : NULL;
+
+  if (ptr == NULL) {
+    lean_allocs++;
+  }
+  block = (unsigned char *)realloc(block, LEAN_HEADER + size);
+  return block + LEAN_HEADER;
+}
+
+static void lean_free(void *ptr) {
+  if (ptr != NULL) {
+    lean_allocs--;
+    free((unsigned char *)ptr - LEAN_HEADER);
+  }
+}
+
+static void lean_nodes(test_batch_runner *runner) {
+  static const char markdown[] = "- a\n"
+                                 "-\n"
+                                 "- b *c* [d](e)\n";
+  cmark_mem mem = {lean_calloc, lean_realloc, lean_free};
+  cmark_parser *parser = cmark_parser_new_with_mem(CMARK_OPT_SOURCEPOS, &mem);
+  cmark_node *doc, *list, *para, *node;
+  int user_data = 0;
+  char *out;
+
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+
+  list = cmark_node_first_child(doc);
+  INT_EQ(runner, cmark_node_get_list_tight(list), 1, "lean_list_tight");
+  para = cmark_node_first_child(cmark_node_last_child(list));
+  out = cmark_render_commonmark(para, CMARK_OPT_DEFAULT, 0);
+  STR_EQ(runner, out, "b *c* [d](e)\n", "lean_render");
+  mem.free(out);
+
+#ifdef CMARK_LEAN_NODES
+  INT_EQ(runner, cmark_node_get_start_line(para), 0, "lean_no_start_line");
+  INT_EQ(runner, cmark_node_get_end_column(para), 0, "lean_no_end_column");
+  INT_EQ(runner, cmark_node_set_user_data(para, &user_data), 0,
+         "lean_no_user_data");
+  OK(runner, cmark_node_get_user_data(para) == NULL, "lean_get_user_data");
+#else
+  INT_EQ(runner, cmark_node_get_start_line(para), 3, "lean_start_line");
+  INT_EQ(runner, cmark_node_get_end_column(para), 14, "lean_end_column");
+  INT_EQ(runner, cmark_node_set_user_data(para, &user_data), 1,
+         "lean_user_data");
+  OK(runner, cmark_node_get_user_data(para) == &user_data,
+     "lean_get_user_data");
+#endif
+
+  // Nodes keep their allocator once they leave the document.
+  node = cmark_node_first_child(para);
+  cmark_node_unlink(node);
+  cmark_node_set_literal(node, "unlinked");
+  STR_EQ(runner, cmark_node_get_literal(node), "unlinked",
+         "lean_unlinked_literal");
+  cmark_node_free(node);
+  node = cmark_node_clone(para);
+  cmark_node_free(node);
+  cmark_node_free(para);
+  node = cmark_node_new_with_mem(CMARK_NODE_TEXT, &mem);
+  cmark_node_set_literal(node, "detached");
+  cmark_node_free(node);
+  cmark_node_free(doc);
+  INT_EQ(runner, lean_allocs, 0, "lean_allocator_balanced");
+}
+
 int main(void) {
   int retval;
   test_batch_runner *runner = test_batch_runner_new();
@@ -642,6 +2191,30 @@ int main(void) {
   test_mlem_blocks(runner);
   test_mlem_create_tree(runner);
   sub_document(runner);
+  preview(runner);
+  lazy_inlines(runner);
+  backtick_spans(runner);
+  delimiter_stacks(runner);
+  text_merging(runner);
+  block_starts(runner);
+  smart_punct(runner);
+  length_accessors(runner);
+  parse_cache(runner);
+  node_hashes(runner);
+  node_diff(runner);
+  retain_source(runner);
+  node_clone(runner);
+  iter_filtered(runner);
+  rewrite_urls(runner);
+  document_summary(runner);
+  mentions(runner);
+  bare_urls(runner);
+  script_spans(runner);
+  render_layout(runner);
+  source_offsets(runner);
+  progressive_blocks(runner);
+  borrowed_content(runner);
+  lean_nodes(runner);
 
   test_print_summary(runner);
   retval = test_ok(runner) ? 0 : 1;
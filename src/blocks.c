@@ -16,6 +16,7 @@
 #include "cmark.h"
 #include "node.h"
 #include "references.h"
+#include "source.h"
 #include "utf8.h"
 #include "scanners.h"
 #include "inlines.h"
@@ -77,9 +78,14 @@ static cmark_node *make_block(cmark_mem *mem, cmark_node_type tag,
   e->mem = mem;
   e->type = (uint16_t)tag;
   e->flags = CMARK_NODE__OPEN;
+#ifdef CMARK_LEAN_NODES
+  (void)start_line;
+  (void)start_column;
+#else
   e->start_line = start_line;
   e->start_column = start_column;
   e->end_line = start_line;
+#endif
 
   return e;
 }
@@ -98,11 +104,16 @@ cmark_parser *cmark_parser_new_with_mem_into_root(int options, cmark_mem *mem, c
   cmark_strbuf_init(mem, &parser->linebuf, 0);
   cmark_strbuf_init(mem, &parser->content, 0);
 
+  // The parser adds children to 'root' without going through the tree
+  // manipulation API.
+  cmark_node_touch(root);
   root->flags = CMARK_NODE__OPEN;
 
   parser->refmap = cmark_reference_map_new(mem);
   parser->root = root;
   parser->current = root;
+  // Children 'root' already has are not handed out as new blocks.
+  parser->last_block = root->last_child;
   parser->line_number = 0;
   parser->offset = 0;
   parser->column = 0;
@@ -114,6 +125,16 @@ cmark_parser *cmark_parser_new_with_mem_into_root(int options, cmark_mem *mem, c
   parser->partially_consumed_tab = false;
   parser->last_line_length = 0;
   parser->options = options;
+  parser->put_line = (options & CMARK_OPT_VALIDATE_UTF8) ? cmark_utf8proc_check
+                                                         : cmark_strbuf_put;
+#ifndef CMARK_LEAN_NODES
+  if (options & CMARK_OPT_RETAIN_SOURCE) {
+    parser->source = cmark_source_new(mem);
+  }
+  if (options & CMARK_OPT_SOURCE_OFFSETS) {
+    parser->line_index = cmark_line_index_new(mem);
+  }
+#endif
   parser->last_buffer_ended_with_cr = false;
 
   return parser;
@@ -134,15 +155,18 @@ void cmark_parser_free(cmark_parser *parser) {
   cmark_strbuf_free(&parser->curline);
   cmark_strbuf_free(&parser->linebuf);
   cmark_reference_map_free(parser->refmap);
+  cmark_source_free(parser->source);
+  cmark_line_index_free(parser->line_index);
+  mem->free(parser->input);
   mem->free(parser);
 }
 
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b);
 
 // Returns true if line has only space characters, else false.
-static bool is_blank(cmark_strbuf *s, bufsize_t offset) {
-  while (offset < s->size) {
-    switch (s->ptr[offset]) {
+static bool is_blank(cmark_chunk *s, bufsize_t offset) {
+  while (offset < s->len) {
+    switch (s->data[offset]) {
     case '\r':
     case '\n':
       return true;
@@ -180,9 +204,21 @@ static inline bool contains_inlines(cmark_node_type block_type) {
           block_type == CMARK_NODE_HEADING);
 }
 
+// Copies borrowed paragraph content into 'content', so that lines that
+// don't follow on from it in the input can be appended.
+static void S_copy_borrowed(cmark_parser *parser) {
+  if (parser->borrowed.data) {
+    cmark_strbuf_put(&parser->content, parser->borrowed.data,
+                     parser->borrowed.len);
+    parser->borrowed.data = NULL;
+    parser->borrowed.len = 0;
+  }
+}
+
 static void add_line(cmark_chunk *ch, cmark_parser *parser) {
   int chars_to_tab;
   int i;
+  S_copy_borrowed(parser);
   if (parser->partially_consumed_tab) {
     parser->offset += 1; // skip over tab
     // add space characters:
@@ -195,6 +231,44 @@ static void add_line(cmark_chunk *ch, cmark_parser *parser) {
                    ch->len - parser->offset);
 }
 
+// Like add_line, but borrows the line from the input when it is parsed
+// in place and directly follows the paragraph's content there.  Tab
+// expansion and prefixes stripped from continuation lines break the run
+// and force a copy.
+static void add_paragraph_line(cmark_chunk *ch, cmark_parser *parser) {
+  const unsigned char *data = ch->data + parser->offset;
+  bufsize_t len = ch->len - parser->offset;
+
+  if (parser->line_in_place && !parser->partially_consumed_tab) {
+    if (parser->borrowed.data == NULL && parser->content.size == 0) {
+      parser->borrowed.data = data;
+      parser->borrowed.len = len;
+      return;
+    }
+    if (parser->borrowed.data &&
+        parser->borrowed.data + parser->borrowed.len == data) {
+      parser->borrowed.len += len;
+      return;
+    }
+  }
+  add_line(ch, parser);
+}
+
+// Hands the content collected for 'b' over to it.  Borrowed content
+// stays in the input, which outlives inline parsing.
+static void S_take_content(cmark_parser *parser, cmark_node *b) {
+  if (parser->borrowed.data) {
+    b->data = (unsigned char *)parser->borrowed.data;
+    b->len = parser->borrowed.len;
+    b->flags |= CMARK_NODE__BORROWED_DATA;
+    parser->borrowed.data = NULL;
+    parser->borrowed.len = 0;
+  } else {
+    b->len = parser->content.size;
+    b->data = cmark_strbuf_detach(&parser->content);
+  }
+}
+
 static void remove_trailing_blank_lines(cmark_strbuf *ln) {
   bufsize_t i;
   unsigned char c;
@@ -242,6 +316,9 @@ static bool resolve_reference_link_definitions(cmark_parser *parser) {
   bufsize_t pos;
   cmark_strbuf *node_content = &parser->content;
   cmark_chunk chunk = {node_content->ptr, node_content->size};
+  if (parser->borrowed.data) {
+    chunk = parser->borrowed;
+  }
   while (chunk.len && chunk.data[0] == '[' &&
          (pos = cmark_parse_reference_inline(parser->mem, &chunk,
                                              parser->refmap))) {
@@ -249,8 +326,13 @@ static bool resolve_reference_link_definitions(cmark_parser *parser) {
     chunk.data += pos;
     chunk.len -= pos;
   }
-  cmark_strbuf_drop(node_content, (node_content->size - chunk.len));
-  return !is_blank(node_content, 0);
+  if (parser->borrowed.data) {
+    parser->borrowed = chunk;
+  } else {
+    cmark_strbuf_drop(node_content, (node_content->size - chunk.len));
+    chunk.data = node_content->ptr;
+  }
+  return !is_blank(&chunk, 0);
 }
 
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
@@ -265,7 +347,8 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
          CMARK_NODE__OPEN); // shouldn't call finalize on closed blocks
   b->flags &= ~CMARK_NODE__OPEN;
 
-  if (parser->curline.size == 0) {
+#ifndef CMARK_LEAN_NODES
+  if (parser->line.len == 0) {
     // end of input - line number has not been incremented
     b->end_line = parser->line_number;
     b->end_column = parser->last_line_length;
@@ -273,15 +356,16 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
              (S_type(b) == CMARK_NODE_CODE_BLOCK && b->as.code.fenced) ||
              (S_type(b) == CMARK_NODE_HEADING && b->as.heading.setext)) {
     b->end_line = parser->line_number;
-    b->end_column = parser->curline.size;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\n')
+    b->end_column = parser->line.len;
+    if (b->end_column && parser->line.data[b->end_column - 1] == '\n')
       b->end_column -= 1;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\r')
+    if (b->end_column && parser->line.data[b->end_column - 1] == '\r')
       b->end_column -= 1;
   } else {
     b->end_line = parser->line_number - 1;
     b->end_column = parser->last_line_length;
   }
+#endif
 
   cmark_strbuf *node_content = &parser->content;
 
@@ -292,9 +376,9 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     if (!has_content) {
       // remove blank node (former reference def)
       cmark_node_free(b);
+      return parent;
     } else {
-      b->len = node_content->size;
-      b->data = cmark_strbuf_detach(node_content);
+      S_take_content(parser, b);
     }
     break;
   }
@@ -318,6 +402,7 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
         houdini_unescape_html_f(&tmp, node_content->ptr, pos);
         cmark_strbuf_trim(&tmp);
         cmark_strbuf_unescape(&tmp);
+        b->as.code.info_len = tmp.size;
         b->as.code.info = cmark_strbuf_detach(&tmp);
       }
 
@@ -332,8 +417,7 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     break;
 
   case CMARK_NODE_HEADING:
-    b->len = node_content->size;
-    b->data = cmark_strbuf_detach(node_content);
+    S_take_content(parser, b);
     break;
 
   case CMARK_NODE_LIST:      // determine tight/loose status
@@ -369,9 +453,31 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     break;
   }
 
+  if (parent == parser->root) {
+    // count completed top-level blocks for the preview limit
+    parser->block_count++;
+    if (parser->block_count == parser->max_blocks)
+      parser->last_counted_block = b;
+  }
+
   return parent;
 }
 
+// Drops 'n' bytes from the start of the current line, in place, as
+// cmark_strbuf_drop would.
+static void S_drop_line(cmark_parser *parser, bufsize_t n) {
+  unsigned char *data = (unsigned char *)parser->line.data;
+
+  if (n > 0) {
+    if (n > parser->line.len)
+      n = parser->line.len;
+    parser->line.len -= n;
+    if (parser->line.len)
+      memmove(data, data + n, parser->line.len);
+    data[parser->line.len] = '\0';
+  }
+}
+
 // Add a node as child of another.  Return pointer to child.
 static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
                              cmark_node_type block_type, int start_column) {
@@ -398,11 +504,34 @@ static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
   return child;
 }
 
+static void parse_leaf_inlines(cmark_mem *mem, cmark_node *leaf,
+                               cmark_reference_map *refmap, int options,
+                               cmark_inline_pool *pool,
+                               cmark_document_summary *summary) {
+  cmark_parse_inlines(mem, leaf, refmap, options, pool, summary);
+  if (leaf->flags & CMARK_NODE__BORROWED_DATA) {
+    leaf->flags &= ~CMARK_NODE__BORROWED_DATA;
+  } else {
+    mem->free(leaf->data);
+  }
+  leaf->data = NULL;
+  leaf->len = 0;
+}
+
 // Walk through node and all children, recursively, parsing
 // string content into inline content where appropriate.
+// If 'lazy' is set, leaf blocks are only flagged for parsing
+// on first access.  Unless 'summary' is NULL, the words in the
+// document and its links are counted on the way.  Leaves parsed
+// early by cmark_parser_parse_block_inlines have no content left
+// and are skipped.  Code blocks keep theirs, so 'early' leaves their
+// words to be counted when parsing finishes.
 static void process_inlines(cmark_mem *mem, cmark_node *root,
-                            cmark_reference_map *refmap, int options) {
+                            cmark_reference_map *refmap, int options,
+                            bool lazy, bool early,
+                            cmark_document_summary *summary) {
   cmark_iter *iter = cmark_iter_new(root);
+  cmark_inline_pool pool = CMARK_INLINE_POOL_INIT(mem);
   cmark_node *cur;
   cmark_event_type ev_type;
 
@@ -410,17 +539,48 @@ static void process_inlines(cmark_mem *mem, cmark_node *root,
     cur = cmark_iter_get_node(iter);
     if (ev_type == CMARK_EVENT_ENTER) {
       if (contains_inlines(S_type(cur))) {
-        cmark_parse_inlines(mem, cur, refmap, options);
-        mem->free(cur->data);
-        cur->data = NULL;
-        cur->len = 0;
+        if (cur->data == NULL) {
+          continue;
+        } else if (!lazy) {
+          parse_leaf_inlines(mem, cur, refmap, options, &pool, summary);
+        } else {
+          cur->flags |= CMARK_NODE__INLINES_PENDING;
+        }
+      } else if (summary && !early && S_type(cur) == CMARK_NODE_CODE_BLOCK) {
+        bool in_word = false;
+        cmark_summary_count_words(summary, &in_word, cur->data, cur->len);
       }
     }
   }
 
+  cmark_inline_pool_free(&pool);
   cmark_iter_free(iter);
 }
 
+void cmark_node_parse_pending_inlines(cmark_node *node) {
+  cmark_node *root = node;
+  cmark_mem *mem = node->mem;
+
+  node->flags &= ~CMARK_NODE__INLINES_PENDING;
+
+  while (root->parent) {
+    root = root->parent;
+  }
+
+  if (S_type(root) == CMARK_NODE_DOCUMENT && root->as.document.refmap) {
+    parse_leaf_inlines(mem, node, root->as.document.refmap,
+                       root->as.document.options, NULL, NULL);
+  } else {
+    // Detached from its document: references can't be resolved, and the
+    // parse options are gone.  Blocks are parsed before they leave their
+    // document (see S_parse_pending_subtree), so this is only a fallback.
+    cmark_reference_map *refmap = cmark_reference_map_new(mem);
+    parse_leaf_inlines(mem, node, refmap, CMARK_OPT_DEFAULT, NULL, NULL);
+    cmark_reference_map_free(refmap);
+  }
+  cmark_node_update_type_masks(node);
+}
+
 // Attempts to parse a list item marker (bullet or enumerated).
 // On success, returns length of the marker, and populates
 // data with the details.  On failure, returns 0.
@@ -518,21 +678,101 @@ static int lists_match(cmark_list *list_data, cmark_list *item_data) {
           list_data->bullet_char == item_data->bullet_char);
 }
 
+// Limit total size of extra content created from reference links to
+// document size to avoid superlinear growth. Always allow 100KB.
+static void S_limit_references(cmark_parser *parser) {
+  if (parser->total_size > 100000)
+    parser->refmap->max_ref_size = parser->total_size;
+  else
+    parser->refmap->max_ref_size = 100000;
+}
+
+// The summary inline parsing counts into, or NULL.  It is reset only
+// once, so blocks parsed before the end of the input still count.
+static cmark_document_summary *S_summary(cmark_parser *parser) {
+  if (parser->summary == NULL &&
+      (parser->options & CMARK_OPT_DOCUMENT_SUMMARY) &&
+      S_type(parser->root) == CMARK_NODE_DOCUMENT) {
+    parser->summary = cmark_document_reset_summary(parser->root);
+  }
+  return parser->summary;
+}
+
 static cmark_node *finalize_document(cmark_parser *parser) {
+  cmark_document_summary *summary;
+
   while (parser->current != parser->root) {
     parser->current = finalize(parser, parser->current);
   }
 
   finalize(parser, parser->root);
 
-  // Limit total size of extra content created from reference links to
-  // document size to avoid superlinear growth. Always allow 100KB.
-  if (parser->total_size > 100000)
-    parser->refmap->max_ref_size = parser->total_size;
-  else
-    parser->refmap->max_ref_size = 100000;
+  // Drop blocks past the preview limit before spending time on their
+  // inline content.
+  if (parser->last_counted_block) {
+    cmark_node *extra = parser->last_counted_block->next;
+    if (extra) {
+      parser->root->flags |= CMARK_NODE__TRUNCATED;
+    }
+    while (extra) {
+      cmark_node *next = extra->next;
+      cmark_node_free(extra);
+      extra = next;
+    }
+  }
+
+  S_limit_references(parser);
+  summary = S_summary(parser);
+
+  if ((parser->options & CMARK_OPT_LAZY_INLINES) && !parser->source &&
+      !summary && S_type(parser->root) == CMARK_NODE_DOCUMENT &&
+      parser->root->as.document.refmap == NULL) {
+    process_inlines(parser->mem, parser->root, parser->refmap,
+                    parser->options, true, false, NULL);
+    // The document takes over the reference map.
+    parser->root->as.document.refmap = parser->refmap;
+    parser->root->as.document.options = parser->options;
+    parser->refmap = NULL;
+  } else {
+    process_inlines(parser->mem, parser->root, parser->refmap,
+                    parser->options, false, false, summary);
+#ifndef CMARK_LEAN_NODES
+    if (parser->options & CMARK_OPT_NODE_HASHES) {
+      cmark_node_get_hash(parser->root);
+    }
+#endif
+  }
 
-  process_inlines(parser->mem, parser->root, parser->refmap, parser->options);
+  cmark_node_update_type_masks(parser->root);
+
+  if (summary) {
+    uint32_t mask = cmark_node_find_types(
+        parser->root, CMARK_NODE_MASK(CMARK_NODE_LINK) |
+                          CMARK_NODE_MASK(CMARK_NODE_SPOILER) |
+                          CMARK_NODE_MASK(CMARK_NODE_CODE) |
+                          CMARK_NODE_MASK(CMARK_NODE_CODE_BLOCK));
+
+    summary->reading_time = (summary->words * 60 + 199) / 200;
+    summary->has_links = (mask & CMARK_NODE_MASK(CMARK_NODE_LINK)) != 0;
+    summary->has_spoilers = (mask & CMARK_NODE_MASK(CMARK_NODE_SPOILER)) != 0;
+    summary->has_code = (mask & (CMARK_NODE_MASK(CMARK_NODE_CODE) |
+                                 CMARK_NODE_MASK(CMARK_NODE_CODE_BLOCK))) != 0;
+  }
+
+#ifndef CMARK_LEAN_NODES
+  if (parser->source && S_type(parser->root) == CMARK_NODE_DOCUMENT) {
+    cmark_source_index_blocks(parser->source, parser->root);
+    cmark_source_free(parser->root->as.document.source);
+    parser->root->as.document.source = parser->source;
+    parser->source = NULL;
+  }
+  if (parser->line_index && S_type(parser->root) == CMARK_NODE_DOCUMENT) {
+    cmark_document_extra *extra = cmark_document_extra_get(parser->root);
+    cmark_line_index_free(extra->line_index);
+    extra->line_index = parser->line_index;
+    parser->line_index = NULL;
+  }
+#endif
 
   cmark_strbuf_free(&parser->content);
 
@@ -558,12 +798,49 @@ cmark_node *cmark_parse_file(FILE *f, int options) {
   return document;
 }
 
+// Feeds all of the input at once.  Scanners write a terminator past the
+// text they scan, so lines and paragraph content can't point into the
+// caller's buffer; instead they point into one writable copy of it,
+// rather than every line being copied into curline and every paragraph
+// line again into 'content'.  Lines ending in carriage returns or
+// containing NUL bytes and input that needs UTF-8 validation are copied
+// as before, and so is content whose inlines may be parsed after the
+// copy is freed.
+static void S_parser_feed_input(cmark_parser *parser, const char *buffer,
+                                size_t len) {
+  if (len > 0 && !(parser->options &
+                   (CMARK_OPT_VALIDATE_UTF8 | CMARK_OPT_LAZY_INLINES))) {
+    parser->input = (unsigned char *)parser->mem->calloc(len + 2, 1);
+    memcpy(parser->input, buffer, len);
+    // The last line gets its newline without being copied.
+    parser->input[len] = '\n';
+    parser->input_len = len + 1;
+    S_parser_feed(parser, parser->input, len, true);
+  } else {
+    S_parser_feed(parser, (const unsigned char *)buffer, len, true);
+  }
+}
+
+cmark_node *cmark_parse_document_preview(const char *buffer, size_t len,
+                                         int options, int max_blocks,
+                                         size_t max_bytes) {
+  cmark_parser *parser = cmark_parser_new(options);
+  cmark_node *document;
+
+  cmark_parser_set_preview_limits(parser, max_blocks, max_bytes);
+  S_parser_feed_input(parser, buffer, len);
+  document = cmark_parser_finish(parser);
+
+  cmark_parser_free(parser);
+  return document;
+}
+
 cmark_node *cmark_parse_document(const char *buffer, size_t len, int options) {
   cmark_parser *parser = cmark_parser_new(options);
   cmark_node *document;
 
   // Blocks are parsed here
-  S_parser_feed(parser, (const unsigned char *)buffer, len, true);
+  S_parser_feed_input(parser, buffer, len);
 
   // Inlines are parsed here
   document = cmark_parser_finish(parser);
@@ -576,9 +853,36 @@ void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len) {
   S_parser_feed(parser, (const unsigned char *)buffer, len, false);
 }
 
+void cmark_parser_set_preview_limits(cmark_parser *parser, int max_blocks,
+                                     size_t max_bytes) {
+  parser->max_blocks = max_blocks > 0 ? max_blocks : 0;
+  parser->max_bytes = max_bytes;
+}
+
+// Returns true once a preview limit has been reached. No further
+// lines are consumed after that.
+static inline bool S_preview_done(const cmark_parser *parser) {
+  return (parser->max_blocks && parser->block_count >= parser->max_blocks) ||
+         (parser->max_bytes && parser->consumed_bytes >= parser->max_bytes);
+}
+
+// Called when input is dropped because of a preview limit. Trailing
+// whitespace doesn't count as truncated content.
+static void S_preview_skip(cmark_parser *parser, const unsigned char *buffer,
+                           const unsigned char *end) {
+  for (; buffer < end; buffer++) {
+    if (!cmark_isspace(*buffer)) {
+      parser->root->flags |= CMARK_NODE__TRUNCATED;
+      break;
+    }
+  }
+}
+
 static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
                           size_t len, bool eof) {
   const unsigned char *end = buffer + len;
+  // Input not yet counted by the line index.
+  const unsigned char *counted = buffer;
   static const uint8_t repl[] = {239, 191, 189};
 
   if (len > UINT_MAX - parser->total_size)
@@ -599,8 +903,22 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
   parser->last_buffer_ended_with_cr = false;
   while (buffer < end) {
     const unsigned char *eol;
+    const unsigned char *line_start = buffer;
     bufsize_t chunk_len;
     bool process = false;
+
+    if (S_preview_done(parser)) {
+      S_preview_skip(parser, buffer, end);
+      break;
+    }
+
+    if (parser->line_index && parser->linebuf.size == 0) {
+      cmark_line_index_advance(parser->line_index, counted,
+                               (bufsize_t)(buffer - counted));
+      counted = buffer;
+      cmark_line_index_start_line(parser->line_index);
+    }
+
     for (eol = buffer; eol < end; ++eol) {
       if (S_is_line_end_char(*eol)) {
         process = true;
@@ -616,6 +934,7 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
 
     chunk_len = (eol - buffer);
     if (process) {
+      parser->consumed_bytes += parser->linebuf.size;
       if (parser->linebuf.size > 0) {
         cmark_strbuf_put(&parser->linebuf, buffer, chunk_len);
         S_process_line(parser, parser->linebuf.ptr, parser->linebuf.size);
@@ -627,6 +946,10 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
       if (eol < end && *eol == '\0') {
         // omit NULL byte
         cmark_strbuf_put(&parser->linebuf, buffer, chunk_len);
+        if (parser->line_index) {
+          cmark_line_index_replace_nul(parser->line_index,
+                                       parser->linebuf.size);
+        }
         // add replacement character
         cmark_strbuf_put(&parser->linebuf, repl, 3);
       } else {
@@ -650,6 +973,13 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
           buffer++;
       }
     }
+    if (process)
+      parser->consumed_bytes += (size_t)(buffer - line_start);
+  }
+
+  if (parser->line_index) {
+    cmark_line_index_advance(parser->line_index, counted,
+                             (bufsize_t)(end - counted));
   }
 }
 
@@ -831,6 +1161,7 @@ static bool parse_spoiler_prefix(cmark_parser *parser, cmark_chunk *input,
   if (matched >= container->as.spoiler.fence_length) {
     // closing fence
     S_advance_offset(parser, input, matched, false);
+    container->flags |= CMARK_NODE__FENCE_CLOSED;
   } else {
     // skip opt. spaces of fence parser->offset
     int i = container->as.spoiler.fence_offset;
@@ -871,6 +1202,7 @@ static bool parse_code_block_prefix(cmark_parser *parser, cmark_chunk *input,
       // the end of a line, we can stop processing it:
       *should_continue = false;
       S_advance_offset(parser, input, matched, false);
+      container->flags |= CMARK_NODE__FENCE_CLOSED;
       parser->current = finalize(parser, container);
     } else {
       // skip opt. spaces of fence parser->offset
@@ -975,9 +1307,41 @@ done:
   return container;
 }
 
+// Block starts that are possible for a given first non-space byte, so that
+// open_new_blocks only runs the scanners that can match.
+enum {
+  BLOCK_START_QUOTE = 1 << 0,
+  BLOCK_START_ATX_HEADING = 1 << 1,
+  BLOCK_START_CODE_FENCE = 1 << 2,
+  BLOCK_START_SPOILER_FENCE = 1 << 3,
+  BLOCK_START_SETEXT_HEADING = 1 << 4,
+  BLOCK_START_THEMATIC_BREAK = 1 << 5,
+  BLOCK_START_LIST_MARKER = 1 << 6,
+};
+
+static const uint8_t BLOCK_STARTS[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  2,  0,  0,  0,  0,  0,  0, 96, 64,  0, 112,  0,  0,
+    64, 64, 64, 64, 64, 64, 64, 64, 64, 64,  8,  0,  0, 16,  1,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 32,
+     4,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+
 static void open_new_blocks(cmark_parser *parser, cmark_node **container,
                             cmark_chunk *input, bool all_matched) {
   bool indented;
+  uint8_t starts;
   cmark_list *data = NULL;
   bool maybe_lazy = S_type(parser->current) == CMARK_NODE_PARAGRAPH;
   cmark_node_type cont_type = S_type(*container);
@@ -993,7 +1357,15 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
     S_find_first_nonspace(parser, input);
     indented = parser->indent >= CODE_INDENT;
 
-    if (!indented && peek_at(input, parser->first_nonspace) == '>') {
+    // Indented lines can only start an indented code block; anything
+    // else that can't start a block is paragraph text.
+    starts = indented ? 0
+                      : BLOCK_STARTS[peek_at(input, parser->first_nonspace)];
+    if (!starts && !indented) {
+      break;
+    }
+
+    if (starts & BLOCK_START_QUOTE) {
 
       bufsize_t blockquote_startpos = parser->first_nonspace;
 
@@ -1006,8 +1378,9 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       *container = add_child(parser, *container, CMARK_NODE_BLOCK_QUOTE,
                              blockquote_startpos + 1);
 
-    } else if (!indented && (matched = scan_atx_heading_start(
-                                 input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_ATX_HEADING) &&
+               (matched = scan_atx_heading_start(input,
+                                                 parser->first_nonspace))) {
       bufsize_t hashpos;
       int level = 0;
       bufsize_t heading_startpos = parser->first_nonspace;
@@ -1029,8 +1402,9 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       (*container)->as.heading.setext = false;
       (*container)->as.heading.internal_offset = matched;
 
-    } else if (!indented && (matched = scan_open_code_fence(
-                                 input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_CODE_FENCE) &&
+               (matched = scan_open_code_fence(input,
+                                               parser->first_nonspace))) {
       *container = add_child(parser, *container, CMARK_NODE_CODE_BLOCK,
                              parser->first_nonspace + 1);
       (*container)->as.code.fenced = true;
@@ -1042,8 +1416,9 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       S_advance_offset(parser, input,
                        parser->first_nonspace + matched - parser->offset,
                        false);
-    } else if (!indented && (matched = scan_open_spoiler_fence(
-                                 input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_SPOILER_FENCE) &&
+               (matched = scan_open_spoiler_fence(input,
+                                                  parser->first_nonspace))) {
       *container = add_child(parser, *container, CMARK_NODE_SPOILER,
                              parser->first_nonspace + 1);
       (*container)->as.spoiler.fence_length = (matched > 255) ? 255 : matched;
@@ -1061,24 +1436,26 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
 
       cmark_strbuf tmp = CMARK_BUF_INIT(parser->mem);
 
-      cmark_strbuf *node_content = &parser->curline;
+      const unsigned char *line = parser->line.data;
 
       int8_t prefix = (*container)->as.spoiler.fence_length + (*container)->as.spoiler.fence_offset;
-      houdini_unescape_html_f(&tmp, node_content->ptr, prefix + pos);
+      houdini_unescape_html_f(&tmp, line, prefix + pos);
       cmark_strbuf_drop(&tmp, prefix);
       cmark_strbuf_trim(&tmp);
       cmark_strbuf_drop(&tmp, 7);
       cmark_strbuf_trim(&tmp);
       cmark_strbuf_unescape(&tmp);
+      (*container)->as.spoiler.title_len = tmp.size;
       (*container)->as.spoiler.title = cmark_strbuf_detach(&tmp);
-      if (node_content->ptr[pos] == '\r')
+      if (line[pos] == '\r')
         pos += 1;
-      if (node_content->ptr[pos] == '\n')
+      if (line[pos] == '\n')
         pos += 1;
-      cmark_strbuf_drop(node_content, pos);
+      S_drop_line(parser, pos);
       parser->line_number ++;
 
-    } else if (!indented && cont_type == CMARK_NODE_PARAGRAPH &&
+    } else if ((starts & BLOCK_START_SETEXT_HEADING) &&
+               cont_type == CMARK_NODE_PARAGRAPH &&
                (lev =
                     scan_setext_heading_line(input, parser->first_nonspace))) {
       // finalize paragraph, resolving reference links
@@ -1091,7 +1468,7 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
         (*container)->as.heading.setext = true;
         S_advance_offset(parser, input, input->len - 1 - parser->offset, false);
       }
-    } else if (!indented &&
+    } else if ((starts & BLOCK_START_THEMATIC_BREAK) &&
                !(cont_type == CMARK_NODE_PARAGRAPH && !all_matched) &&
                (parser->thematic_break_kill_pos <= parser->first_nonspace) &&
                S_scan_thematic_break(parser, input, parser->first_nonspace)) {
@@ -1099,8 +1476,7 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       *container = add_child(parser, *container, CMARK_NODE_THEMATIC_BREAK,
                              parser->first_nonspace + 1);
       S_advance_offset(parser, input, input->len - 1 - parser->offset, false);
-    } else if ((!indented || cont_type == CMARK_NODE_LIST) &&
-               parser->indent < 4 &&
+    } else if ((starts & BLOCK_START_LIST_MARKER) &&
                (matched = parse_list_marker(
                     parser->mem, input, parser->first_nonspace,
                     (*container)->type == CMARK_NODE_PARAGRAPH, &data))) {
@@ -1154,6 +1530,7 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       // add the list item
       *container = add_child(parser, *container, CMARK_NODE_ITEM,
                              parser->first_nonspace + 1);
+      parser->new_item = *container;
       /* TODO: static */
       memcpy(&((*container)->as.list), data, sizeof(*data));
       parser->mem->free(data);
@@ -1203,7 +1580,7 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
        ctype != CMARK_NODE_HEADING && ctype != CMARK_NODE_THEMATIC_BREAK &&
        !(ctype == CMARK_NODE_CODE_BLOCK && container->as.code.fenced) &&
        !(ctype == CMARK_NODE_ITEM && container->first_child == NULL &&
-         container->start_line == parser->line_number));
+         container == parser->new_item));
 
   S_set_last_line_blank(container, last_line_blank);
 
@@ -1222,7 +1599,7 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
   if (parser->current != last_matched_container &&
       container == last_matched_container && !parser->blank &&
       S_type(parser->current) == CMARK_NODE_PARAGRAPH) {
-    add_line(input, parser);
+    add_paragraph_line(input, parser);
   } else { // not a lazy continuation
     // Finalize any blocks that were not matched and set cur to container:
     while (parser->current != last_matched_container) {
@@ -1241,14 +1618,18 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
       }
       S_advance_offset(parser, input, parser->first_nonspace - parser->offset,
                        false);
-      add_line(input, parser);
+      if (S_type(container) == CMARK_NODE_PARAGRAPH) {
+        add_paragraph_line(input, parser);
+      } else {
+        add_line(input, parser);
+      }
     } else {
       // create paragraph container for line
       container = add_child(parser, container, CMARK_NODE_PARAGRAPH,
                             parser->first_nonspace + 1);
       S_advance_offset(parser, input, parser->first_nonspace - parser->offset,
                        false);
-      add_line(input, parser);
+      add_paragraph_line(input, parser);
     }
 
     parser->current = container;
@@ -1263,16 +1644,45 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   cmark_node *container;
   cmark_chunk input;
 
-  if (parser->options & CMARK_OPT_VALIDATE_UTF8)
-    cmark_utf8proc_check(&parser->curline, buffer, bytes);
-  else
-    cmark_strbuf_put(&parser->curline, buffer, bytes);
+  // A line of the input copy that ends in a newline is exactly what would
+  // be copied into curline, so it is parsed where it is.
+  parser->line_in_place =
+      parser->input && buffer >= parser->input &&
+      buffer + bytes < parser->input + parser->input_len &&
+      buffer[bytes] == '\n';
+  if (parser->line_in_place) {
+    parser->line.data = buffer;
+    parser->line.len = bytes + 1;
+  } else {
+    if (parser->line_index && (parser->options & CMARK_OPT_VALIDATE_UTF8)) {
+      cmark_line_index_validate_line(parser->line_index, buffer, bytes);
+    }
+    parser->put_line(&parser->curline, buffer, bytes);
+
+    bytes = parser->curline.size;
 
-  bytes = parser->curline.size;
+    // ensure line ends with a newline:
+    if (bytes == 0 || !S_is_line_end_char(parser->curline.ptr[bytes - 1]))
+      cmark_strbuf_putc(&parser->curline, '\n');
 
-  // ensure line ends with a newline:
-  if (bytes == 0 || !S_is_line_end_char(parser->curline.ptr[bytes - 1]))
-    cmark_strbuf_putc(&parser->curline, '\n');
+    parser->line.data = parser->curline.ptr;
+    parser->line.len = parser->curline.size;
+  }
+
+  if (parser->source || parser->line_index) {
+    bufsize_t len = parser->line.len;
+    while (len && S_is_line_end_char(parser->line.data[len - 1])) {
+      len--;
+    }
+    if (parser->source) {
+      cmark_source_add_line(parser->source, parser->line_number + 1,
+                            parser->line.data, len);
+    }
+    if (parser->line_index) {
+      cmark_line_index_add_line(parser->line_index, parser->line_number + 1,
+                                parser->line.data, len);
+    }
+  }
 
   parser->offset = 0;
   parser->column = 0;
@@ -1282,9 +1692,9 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   parser->indent = 0;
   parser->blank = false;
   parser->partially_consumed_tab = false;
+  parser->new_item = NULL;
 
-  input.data = parser->curline.ptr;
-  input.len = parser->curline.size;
+  input = parser->line;
 
   parser->line_number++;
 
@@ -1300,6 +1710,7 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   add_text_to_container(parser, container, last_matched_container, &input);
 
 finished:
+#ifndef CMARK_LEAN_NODES
   parser->last_line_length = input.len;
   if (parser->last_line_length &&
       input.data[parser->last_line_length - 1] == '\n')
@@ -1307,8 +1718,40 @@ finished:
   if (parser->last_line_length &&
       input.data[parser->last_line_length - 1] == '\r')
     parser->last_line_length -= 1;
+#endif
 
   cmark_strbuf_clear(&parser->curline);
+  parser->line.data = NULL;
+  parser->line.len = 0;
+  parser->line_in_place = false;
+}
+
+cmark_node *cmark_parser_next_block(cmark_parser *parser) {
+  cmark_node *next = parser->last_block ? parser->last_block->next
+                                        : parser->root->first_child;
+
+  // Blocks past the preview limit are dropped when parsing finishes.
+  if (next == NULL || (next->flags & CMARK_NODE__OPEN) ||
+      (parser->last_counted_block &&
+       parser->last_block == parser->last_counted_block)) {
+    return NULL;
+  }
+  parser->last_block = next;
+  return next;
+}
+
+void cmark_parser_parse_block_inlines(cmark_parser *parser,
+                                      cmark_node *block) {
+  // After cmark_parser_finish, inline content has been parsed already or
+  // the document owns the reference map.
+  if (block == NULL || (block->flags & CMARK_NODE__OPEN) ||
+      parser->refmap == NULL) {
+    return;
+  }
+  S_limit_references(parser);
+  process_inlines(parser->mem, block, parser->refmap, parser->options, false,
+                  true, S_summary(parser));
+  cmark_node_update_type_masks(block);
 }
 
 cmark_node *cmark_parser_finish(cmark_parser *parser) {
@@ -1319,8 +1762,6 @@ cmark_node *cmark_parser_finish(cmark_parser *parser) {
 
   finalize_document(parser);
 
-  cmark_consolidate_text_nodes(parser->root);
-
   cmark_strbuf_free(&parser->curline);
 
 #if CMARK_DEBUG_NODES
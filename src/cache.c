@@ -0,0 +1,379 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "cmark.h"
+#include "hash.h"
+#include "node.h"
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION cmark_mutex;
+#define cmark_mutex_init(m) InitializeCriticalSection(m)
+#define cmark_mutex_destroy(m) DeleteCriticalSection(m)
+#define cmark_mutex_lock(m) EnterCriticalSection(m)
+#define cmark_mutex_unlock(m) LeaveCriticalSection(m)
+#else
+typedef pthread_mutex_t cmark_mutex;
+#define cmark_mutex_init(m) pthread_mutex_init(m, NULL)
+#define cmark_mutex_destroy(m) pthread_mutex_destroy(m)
+#define cmark_mutex_lock(m) pthread_mutex_lock(m)
+#define cmark_mutex_unlock(m) pthread_mutex_unlock(m)
+#endif
+
+#define MIN_BUCKETS 64
+
+typedef struct cmark_cache_entry {
+  // Chains in the input and document hash tables.
+  struct cmark_cache_entry *next;
+  struct cmark_cache_entry *doc_next;
+  // Recency list of cached entries, most recently used first.
+  struct cmark_cache_entry *lru_prev;
+  struct cmark_cache_entry *lru_next;
+  uint64_t hash;
+  unsigned char *input;
+  size_t len;
+  int options;
+  cmark_node *document;
+  // Bytes charged against the cache while the entry is cached.
+  size_t size;
+  unsigned int refcount;
+  // False once evicted; the entry lives on until its last release.
+  bool cached;
+} cmark_cache_entry;
+
+struct cmark_cache {
+  cmark_mem *mem;
+  cmark_mutex lock;
+  // Cached entries by input hash, and all live entries by document.
+  cmark_cache_entry **buckets;
+  cmark_cache_entry **doc_buckets;
+  size_t num_buckets;
+  size_t num_entries;
+  cmark_cache_entry *lru_head;
+  cmark_cache_entry *lru_tail;
+  size_t bytes;
+  size_t max_bytes;
+};
+
+static inline size_t S_doc_bucket(cmark_cache *cache, cmark_node *document) {
+  return (size_t)cmark_hash_mix((uint64_t)(uintptr_t)document) &
+         (cache->num_buckets - 1);
+}
+
+// Approximate memory held by a parsed tree.
+static size_t S_tree_size(cmark_node *root) {
+  size_t size = 0;
+  cmark_node *cur = root;
+
+  while (cur) {
+    size += sizeof(cmark_node);
+    if (cur->data) {
+      size += (size_t)cur->len + 1;
+    }
+    switch (cur->type) {
+    case CMARK_NODE_CODE_BLOCK:
+      size += (size_t)cur->as.code.info_len + 1;
+      break;
+    case CMARK_NODE_SPOILER:
+      size += (size_t)cur->as.spoiler.title_len + 1;
+      break;
+    case CMARK_NODE_LINK:
+    case CMARK_NODE_IMAGE:
+      size += (size_t)cur->as.link.url_len + cur->as.link.title_len + 2;
+      break;
+    default:
+      break;
+    }
+
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != root && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == root ? NULL : cur->next;
+  }
+
+  return size;
+}
+
+cmark_cache *cmark_cache_new(size_t max_bytes) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_cache *cache = (cmark_cache *)mem->calloc(1, sizeof(cmark_cache));
+
+  cache->mem = mem;
+  cache->max_bytes = max_bytes;
+  cache->num_buckets = MIN_BUCKETS;
+  cache->buckets = (cmark_cache_entry **)mem->calloc(
+      cache->num_buckets, sizeof(cmark_cache_entry *));
+  cache->doc_buckets = (cmark_cache_entry **)mem->calloc(
+      cache->num_buckets, sizeof(cmark_cache_entry *));
+  cmark_mutex_init(&cache->lock);
+  return cache;
+}
+
+static void S_entry_free(cmark_cache *cache, cmark_cache_entry *entry) {
+  cmark_node_free(entry->document);
+  cache->mem->free(entry->input);
+  cache->mem->free(entry);
+}
+
+void cmark_cache_free(cmark_cache *cache) {
+  size_t i;
+
+  if (cache == NULL) {
+    return;
+  }
+
+  for (i = 0; i < cache->num_buckets; i++) {
+    cmark_cache_entry *entry = cache->doc_buckets[i];
+    while (entry) {
+      cmark_cache_entry *next = entry->doc_next;
+      assert(entry->refcount == 0);
+      S_entry_free(cache, entry);
+      entry = next;
+    }
+  }
+  cmark_mutex_destroy(&cache->lock);
+  cache->mem->free(cache->buckets);
+  cache->mem->free(cache->doc_buckets);
+  cache->mem->free(cache);
+}
+
+static void S_grow(cmark_cache *cache) {
+  size_t num_buckets = cache->num_buckets * 2;
+  cmark_cache_entry **buckets = (cmark_cache_entry **)cache->mem->calloc(
+      num_buckets, sizeof(cmark_cache_entry *));
+  cmark_cache_entry **doc_buckets = (cmark_cache_entry **)cache->mem->calloc(
+      num_buckets, sizeof(cmark_cache_entry *));
+  size_t i;
+
+  for (i = 0; i < cache->num_buckets; i++) {
+    cmark_cache_entry *entry = cache->buckets[i];
+    while (entry) {
+      cmark_cache_entry *next = entry->next;
+      size_t b = (size_t)entry->hash & (num_buckets - 1);
+      entry->next = buckets[b];
+      buckets[b] = entry;
+      entry = next;
+    }
+  }
+  cache->mem->free(cache->buckets);
+  cache->buckets = buckets;
+
+  for (i = 0; i < cache->num_buckets; i++) {
+    cmark_cache_entry *entry = cache->doc_buckets[i];
+    while (entry) {
+      cmark_cache_entry *next = entry->doc_next;
+      size_t b =
+          (size_t)cmark_hash_mix((uint64_t)(uintptr_t)entry->document) &
+          (num_buckets - 1);
+      entry->doc_next = doc_buckets[b];
+      doc_buckets[b] = entry;
+      entry = next;
+    }
+  }
+  cache->mem->free(cache->doc_buckets);
+  cache->doc_buckets = doc_buckets;
+  cache->num_buckets = num_buckets;
+}
+
+static void S_lru_unlink(cmark_cache *cache, cmark_cache_entry *entry) {
+  if (entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if (entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void S_lru_push(cmark_cache *cache, cmark_cache_entry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head) {
+    cache->lru_head->lru_prev = entry;
+  } else {
+    cache->lru_tail = entry;
+  }
+  cache->lru_head = entry;
+}
+
+static cmark_cache_entry *S_lookup(cmark_cache *cache, uint64_t hash,
+                                   const char *buffer, size_t len,
+                                   int options) {
+  cmark_cache_entry *entry = cache->buckets[hash & (cache->num_buckets - 1)];
+
+  while (entry) {
+    if (entry->hash == hash && entry->len == len &&
+        entry->options == options && memcmp(entry->input, buffer, len) == 0) {
+      return entry;
+    }
+    entry = entry->next;
+  }
+  return NULL;
+}
+
+static void S_remove_doc(cmark_cache *cache, cmark_cache_entry *entry) {
+  cmark_cache_entry **link =
+      &cache->doc_buckets[S_doc_bucket(cache, entry->document)];
+
+  while (*link != entry) {
+    link = &(*link)->doc_next;
+  }
+  *link = entry->doc_next;
+  cache->num_entries--;
+}
+
+// Drops 'entry' from the cache.  Returns true if it's unreferenced and
+// should be freed; otherwise it's freed on its last release.
+static bool S_evict(cmark_cache *cache, cmark_cache_entry *entry) {
+  cmark_cache_entry **link =
+      &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+
+  while (*link != entry) {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  S_lru_unlink(cache, entry);
+  cache->bytes -= entry->size;
+  entry->cached = false;
+
+  if (entry->refcount == 0) {
+    S_remove_doc(cache, entry);
+    return true;
+  }
+  return false;
+}
+
+cmark_node *cmark_cache_parse(cmark_cache *cache, const char *buffer,
+                              size_t len, int options) {
+  cmark_cache_entry *entry, *found;
+  cmark_cache_entry *evicted = NULL;
+  uint64_t hash;
+  size_t b;
+
+  // Cached documents are shared, so their inlines can't be parsed on
+  // first access.
+  options &= ~CMARK_OPT_LAZY_INLINES;
+  hash = cmark_hash_bytes((const unsigned char *)buffer, len,
+                          (uint64_t)(unsigned)options);
+
+  cmark_mutex_lock(&cache->lock);
+  found = S_lookup(cache, hash, buffer, len, options);
+  if (found) {
+    found->refcount++;
+    S_lru_unlink(cache, found);
+    S_lru_push(cache, found);
+    cmark_mutex_unlock(&cache->lock);
+    return found->document;
+  }
+  cmark_mutex_unlock(&cache->lock);
+
+  // Parse without holding the lock.
+  entry = (cmark_cache_entry *)cache->mem->calloc(1, sizeof(*entry));
+  entry->hash = hash;
+  entry->len = len;
+  entry->options = options;
+  entry->refcount = 1;
+  entry->document = cmark_parse_document(buffer, len, options);
+  // Computing hashes on first use would write to the shared tree.
+  cmark_node_get_hash(entry->document);
+  entry->size = sizeof(*entry) + len + S_tree_size(entry->document);
+
+  cmark_mutex_lock(&cache->lock);
+  found = S_lookup(cache, hash, buffer, len, options);
+  if (found) {
+    // Another thread parsed the same input in the meantime.
+    found->refcount++;
+    S_lru_unlink(cache, found);
+    S_lru_push(cache, found);
+    cmark_mutex_unlock(&cache->lock);
+    S_entry_free(cache, entry);
+    return found->document;
+  }
+
+  if (cache->num_entries >= cache->num_buckets) {
+    S_grow(cache);
+  }
+  b = S_doc_bucket(cache, entry->document);
+  entry->doc_next = cache->doc_buckets[b];
+  cache->doc_buckets[b] = entry;
+  cache->num_entries++;
+
+  if (entry->size <= cache->max_bytes) {
+    entry->input = (unsigned char *)cache->mem->realloc(NULL, len + 1);
+    memcpy(entry->input, buffer, len);
+    entry->input[len] = 0;
+    b = (size_t)hash & (cache->num_buckets - 1);
+    entry->next = cache->buckets[b];
+    cache->buckets[b] = entry;
+    S_lru_push(cache, entry);
+    entry->cached = true;
+    cache->bytes += entry->size;
+
+    while (cache->bytes > cache->max_bytes) {
+      cmark_cache_entry *victim = cache->lru_tail;
+      if (S_evict(cache, victim)) {
+        victim->next = evicted;
+        evicted = victim;
+      }
+    }
+  }
+  cmark_mutex_unlock(&cache->lock);
+
+  // Free evicted trees outside of the lock.
+  while (evicted) {
+    cmark_cache_entry *next = evicted->next;
+    S_entry_free(cache, evicted);
+    evicted = next;
+  }
+
+  return entry->document;
+}
+
+void cmark_cache_release(cmark_cache *cache, cmark_node *document) {
+  cmark_cache_entry *entry;
+  bool free_entry = false;
+
+  if (cache == NULL || document == NULL) {
+    return;
+  }
+
+  cmark_mutex_lock(&cache->lock);
+  entry = cache->doc_buckets[S_doc_bucket(cache, document)];
+  while (entry && entry->document != document) {
+    entry = entry->doc_next;
+  }
+  assert(entry && entry->refcount > 0);
+  if (entry && --entry->refcount == 0 && !entry->cached) {
+    S_remove_doc(cache, entry);
+    free_entry = true;
+  }
+  cmark_mutex_unlock(&cache->lock);
+
+  if (free_entry) {
+    S_entry_free(cache, entry);
+  }
+}
+
+size_t cmark_cache_get_size(cmark_cache *cache) {
+  size_t bytes;
+
+  cmark_mutex_lock(&cache->lock);
+  bytes = cache->bytes;
+  cmark_mutex_unlock(&cache->lock);
+  return bytes;
+}
@@ -2,6 +2,7 @@
 #define CMARK_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <cmark_export.h>
 #include <cmark_version.h>
 
@@ -75,9 +76,17 @@ typedef enum {
   CMARK_PAREN_DELIM
 } cmark_delim_type;
 
+typedef enum {
+  CMARK_NO_MENTION,
+  CMARK_USER_MENTION,
+  CMARK_COMMUNITY_MENTION
+} cmark_mention_type;
+
 typedef struct cmark_node cmark_node;
 typedef struct cmark_parser cmark_parser;
 typedef struct cmark_iter cmark_iter;
+typedef struct cmark_cache cmark_cache;
+typedef struct cmark_diff cmark_diff;
 
 /**
  * ## Custom memory allocator support
@@ -117,6 +126,46 @@ CMARK_EXPORT cmark_node *cmark_node_new_with_mem(cmark_node_type type,
  */
 CMARK_EXPORT void cmark_node_free(cmark_node *node);
 
+/** Returns a detached copy of the subtree rooted at 'node', to be freed
+ * with `cmark_node_free`.  Only the nodes are copied: literals, URLs,
+ * titles and other strings are shared with the original until they're
+ * replaced through the clone's setters, so the original must outlive the
+ * clone and keep its strings unchanged.  Cloning a document from
+ * `cmark_cache_parse` gives each caller a tree of its own to transform.
+ * A cloned document doesn't carry the source kept by
+ * `CMARK_OPT_RETAIN_SOURCE` or the offsets kept by
+ * `CMARK_OPT_SOURCE_OFFSETS`.
+ */
+CMARK_EXPORT cmark_node *cmark_node_clone(cmark_node *node);
+
+/** Facts about a document gathered while it was parsed with
+ * `CMARK_OPT_DOCUMENT_SUMMARY`.
+ */
+typedef struct cmark_document_summary {
+  /** Words in paragraphs, headings, code spans and code blocks. */
+  size_t words;
+  /** Estimated reading time in seconds, at 200 words per minute. */
+  size_t reading_time;
+  /** Number of links, autolinks included. */
+  size_t links;
+  size_t images;
+  /** URL of the first image, or NULL if there is none. */
+  const char *first_image_url;
+  int has_links;
+  int has_spoilers;
+  /** Set if there are code spans or code blocks. */
+  int has_code;
+} cmark_document_summary;
+
+/** Returns the summary of a document parsed with
+ * `CMARK_OPT_DOCUMENT_SUMMARY`, or NULL if 'node' is not such a document.
+ * The summary describes the input as parsed; later changes to the tree
+ * aren't reflected.  It is owned by the document and carried over by
+ * `cmark_node_clone`.
+ */
+CMARK_EXPORT const cmark_document_summary *
+cmark_document_get_summary(cmark_node *node);
+
 /**
  * ## Tree Traversal
  */
@@ -203,6 +252,24 @@ typedef enum {
 CMARK_EXPORT
 cmark_iter *cmark_iter_new(cmark_node *root);
 
+/** The bit standing for node type 'type' in a type mask.
+ */
+#define CMARK_NODE_MASK(type) ((uint32_t)1 << (type))
+
+/** Like `cmark_iter_new`, but skips the subtrees of 'root' without a node
+ * of one of the types in 'type_mask', made of `CMARK_NODE_MASK` bits.
+ * The iterator visits the nodes of those types and their ancestors.
+ * Each node records the types in its subtree, so skipped branches
+ * aren't walked.  After nodes are unlinked, the records may still list
+ * types no longer there, and blocks whose inlines haven't been parsed
+ * yet (see `CMARK_OPT_LAZY_INLINES`) are assumed to hold every inline
+ * type, making the iterator enter some branches in vain.  Lean builds
+ * (`CMARK_LEAN_NODES`) keep no such records and search each branch
+ * before entering it instead.
+ */
+CMARK_EXPORT
+cmark_iter *cmark_iter_new_filtered(cmark_node *root, uint32_t type_mask);
+
 /** Frees the memory allocated for an iterator.
  */
 CMARK_EXPORT
@@ -241,12 +308,14 @@ void cmark_iter_reset(cmark_iter *iter, cmark_node *current,
  * ## Accessors
  */
 
-/** Returns the user data of 'node'.
+/** Returns the user data of 'node'.  Always NULL in builds with
+ * `CMARK_LEAN_NODES`.
  */
 CMARK_EXPORT void *cmark_node_get_user_data(cmark_node *node);
 
 /** Sets arbitrary user data for 'node'.  Returns 1 on success,
- * 0 on failure.
+ * 0 on failure.  Builds with `CMARK_LEAN_NODES` have no user data and
+ * always fail.
  */
 CMARK_EXPORT int cmark_node_set_user_data(cmark_node *node, void *user_data);
 
@@ -271,6 +340,19 @@ CMARK_EXPORT const char *cmark_node_get_literal(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_set_literal(cmark_node *node, const char *content);
 
+/** Like `cmark_node_get_literal`, but also stores the length of the
+ * string in 'len', so callers don't need to call `strlen`.
+ */
+CMARK_EXPORT const char *cmark_node_get_literal_n(cmark_node *node,
+                                                  size_t *len);
+
+/** Sets the string contents of 'node' to the 'len' bytes at 'content',
+ * which don't need to be NUL-terminated.  Returns 1 on success, 0 on
+ * failure.
+ */
+CMARK_EXPORT int cmark_node_set_literal_n(cmark_node *node,
+                                          const char *content, size_t len);
+
 /** Returns the heading level of 'node', or 0 if 'node' is not a heading.
  */
 CMARK_EXPORT int cmark_node_get_heading_level(cmark_node *node);
@@ -330,6 +412,18 @@ CMARK_EXPORT const char *cmark_node_get_fence_info(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_set_fence_info(cmark_node *node, const char *info);
 
+/** Like `cmark_node_get_fence_info`, but also stores the length of the
+ * info string in 'len'.
+ */
+CMARK_EXPORT const char *cmark_node_get_fence_info_n(cmark_node *node,
+                                                     size_t *len);
+
+/** Sets the info string in a fenced code block to the 'len' bytes at
+ * 'info', returning 1 on success and 0 on failure.
+ */
+CMARK_EXPORT int cmark_node_set_fence_info_n(cmark_node *node,
+                                             const char *info, size_t len);
+
 /** Returns the URL of a link or image 'node', or an empty string
     if no URL is set.  Returns NULL if called on a node that is
     not a link or image.
@@ -341,6 +435,28 @@ CMARK_EXPORT const char *cmark_node_get_url(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_set_url(cmark_node *node, const char *url);
 
+/** Like `cmark_node_get_url`, but also stores the length of the URL
+ * in 'len'.
+ */
+CMARK_EXPORT const char *cmark_node_get_url_n(cmark_node *node, size_t *len);
+
+/** Sets the URL of a link or image 'node' to the 'len' bytes at 'url'.
+ * Returns 1 on success, 0 on failure.
+ */
+CMARK_EXPORT int cmark_node_set_url_n(cmark_node *node, const char *url,
+                                      size_t len);
+
+/** Returns the kind of Lemmy mention a link 'node' was parsed from with
+ * `CMARK_OPT_MENTIONS`, or `CMARK_NO_MENTION` if it's not a mention.
+ * For a mention, the user or community name and the instance are stored
+ * in 'name' and 'instance' unless they're NULL.  They point into the
+ * URL and aren't NUL-terminated.  Setting the URL makes the link an
+ * ordinary one.
+ */
+CMARK_EXPORT cmark_mention_type
+cmark_node_get_mention(cmark_node *node, const char **name, size_t *name_len,
+                       const char **instance, size_t *instance_len);
+
 /** Returns the title of a link or image 'node', or an empty
     string if no title is set.  Returns NULL if called on a node
     that is not a link or image.
@@ -352,6 +468,18 @@ CMARK_EXPORT const char *cmark_node_get_title(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_set_title(cmark_node *node, const char *title);
 
+/** Like `cmark_node_get_title`, but also stores the length of the title
+ * in 'len'.  Also returns the title of a spoiler 'node'.
+ */
+CMARK_EXPORT const char *cmark_node_get_title_n(cmark_node *node,
+                                                size_t *len);
+
+/** Sets the title of a link or image 'node' to the 'len' bytes at
+ * 'title'.  Returns 1 on success, 0 on failure.
+ */
+CMARK_EXPORT int cmark_node_set_title_n(cmark_node *node, const char *title,
+                                        size_t len);
+
 /** Returns the literal "on enter" text for a custom 'node', or
     an empty string if no on_enter is set.  Returns NULL if called
     on a non-custom node.
@@ -377,7 +505,9 @@ CMARK_EXPORT const char *cmark_node_get_on_exit(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_set_on_exit(cmark_node *node, const char *on_exit);
 
-/** Returns the line on which 'node' begins.
+/** Returns the line on which 'node' begins.  The source position
+ * getters return 0 in builds with `CMARK_LEAN_NODES`, which don't track
+ * source positions.
  */
 CMARK_EXPORT int cmark_node_get_start_line(cmark_node *node);
 
@@ -393,6 +523,44 @@ CMARK_EXPORT int cmark_node_get_end_line(cmark_node *node);
  */
 CMARK_EXPORT int cmark_node_get_end_column(cmark_node *node);
 
+/** Converts the source position 'line', 'column' in 'document', parsed
+ * with `CMARK_OPT_SOURCE_OFFSETS`, to a byte offset in the input, in
+ * constant time.  'column' may be one past the end of the line, so that
+ * a node ends at its end column + 1.  Returns 1 on success, 0 if the
+ * document has no offsets or the position is outside of it.  Columns
+ * count the U+FFFD put in place of a NUL byte, or of invalid UTF-8 with
+ * `CMARK_OPT_VALIDATE_UTF8`; the offset is corrected for the input it
+ * replaced, taking time logarithmic in the replacements on the line.  A
+ * column inside U+FFFD gives the offset of what it replaced.
+ */
+CMARK_EXPORT int cmark_document_get_byte_offset(cmark_node *document,
+                                                int line, int column,
+                                                size_t *offset);
+
+/** Like `cmark_document_get_byte_offset`, but counts UTF-16 code units,
+ * as Swift and Java strings do, in time logarithmic in the length of the
+ * line.  NUL bytes and invalid UTF-8 count as one code unit each.
+ */
+CMARK_EXPORT int cmark_document_get_utf16_offset(cmark_node *document,
+                                                 int line, int column,
+                                                 size_t *offset);
+
+/** Returns 1 if 'node' is a document whose parse stopped at a preview
+ * limit before consuming all of its input, 0 otherwise.  See
+ * `cmark_parser_set_preview_limits`.
+ */
+CMARK_EXPORT int cmark_node_get_truncated(cmark_node *node);
+
+/** Returns a 64-bit hash of the structure and content of the subtree
+ * rooted at 'node': node types, literals, URLs, titles and other
+ * attributes, but not source positions.  Equal subtrees hash equally,
+ * so different hashes mean different subtrees.  Hashes are cached on the
+ * nodes and recomputed only for the parts of a tree changed since, except
+ * in lean builds (`CMARK_LEAN_NODES`), where every call hashes the whole
+ * subtree.  Returns 0 if 'node' is NULL.
+ */
+CMARK_EXPORT uint64_t cmark_node_get_hash(cmark_node *node);
+
 /**
  * ## Tree Manipulation
  */
@@ -431,6 +599,26 @@ CMARK_EXPORT int cmark_node_append_child(cmark_node *node, cmark_node *child);
  */
 CMARK_EXPORT void cmark_consolidate_text_nodes(cmark_node *root);
 
+/** Called by `cmark_node_rewrite_urls` with a link or image 'node', its
+ * URL and the caller's 'data'.  Returns the URL to replace it with, which
+ * is copied, or NULL to leave it unchanged.  It must not modify the tree.
+ */
+typedef const char *(*cmark_url_rewriter)(cmark_node *node, const char *url,
+                                          void *data);
+
+/** Passes the URL of every link and image under 'root' to 'rewriter' and
+ * replaces it with the result, skipping subtrees without links.  Returns
+ * the number of URLs replaced.
+ *
+ * Inside a document, the new URLs are copied into one block owned by the
+ * document rather than allocated one by one.  They stay valid as long as
+ * the document, so a rewritten node that's unlinked must be freed first,
+ * unless its URL is set again.
+ */
+CMARK_EXPORT int cmark_node_rewrite_urls(cmark_node *root,
+                                         cmark_url_rewriter rewriter,
+                                         void *data);
+
 /**
  * ## Parsing
  *
@@ -505,6 +693,41 @@ void cmark_parser_free(cmark_parser *parser);
 CMARK_EXPORT
 void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len);
 
+/** Limits how much input 'parser' consumes, for rendering previews of
+ * long documents.  Once 'max_blocks' top-level blocks have been closed,
+ * or at least 'max_bytes' bytes of input have been consumed, the rest of
+ * the input is ignored: open blocks are closed as if the input ended
+ * there, blocks after the first 'max_blocks' are dropped, and the
+ * document is flagged as truncated (see `cmark_node_get_truncated`).
+ * Input is only ever cut at line boundaries.  A limit of 0 means no
+ * limit.  Must be called before the first call to `cmark_parser_feed`.
+ */
+CMARK_EXPORT
+void cmark_parser_set_preview_limits(cmark_parser *parser, int max_blocks,
+                                     size_t max_bytes);
+
+/** Returns the next top-level block that 'parser' has closed, in
+ * document order, or NULL if the next block is still open or there is
+ * none yet.  Call it after each `cmark_parser_feed` to handle blocks as
+ * the input arrives; after `cmark_parser_finish` it returns the
+ * remaining blocks.  Paragraphs and headings in a returned block have no
+ * inline children until `cmark_parser_finish`, which resolves references
+ * defined anywhere in the input, or until
+ * `cmark_parser_parse_block_inlines`.  The block stays part of the
+ * document and must not be freed or moved.
+ */
+CMARK_EXPORT
+cmark_node *cmark_parser_next_block(cmark_parser *parser);
+
+/** Parses the inline content of 'block', a block returned by
+ * `cmark_parser_next_block`, right away.  Only reference definitions
+ * seen so far are resolved; `cmark_parser_finish` leaves the result as
+ * it is.  Does nothing once parsing has finished.
+ */
+CMARK_EXPORT
+void cmark_parser_parse_block_inlines(cmark_parser *parser,
+                                      cmark_node *block);
+
 /** Finish parsing and return a pointer to a tree of nodes.
  */
 CMARK_EXPORT
@@ -518,6 +741,15 @@ cmark_node *cmark_parser_finish(cmark_parser *parser);
 CMARK_EXPORT
 cmark_node *cmark_parse_document(const char *buffer, size_t len, int options);
 
+/** Like `cmark_parse_document`, but stops after 'max_blocks' top-level
+ * blocks or 'max_bytes' bytes of input, whichever comes first.  See
+ * `cmark_parser_set_preview_limits`.
+ */
+CMARK_EXPORT
+cmark_node *cmark_parse_document_preview(const char *buffer, size_t len,
+                                         int options, int max_blocks,
+                                         size_t max_bytes);
+
 /** Parse a CommonMark document in file 'f', returning a pointer to
  * a tree of nodes.  The memory allocated for the node tree should be
  * released using 'cmark_node_free' when it is no longer needed.
@@ -527,10 +759,169 @@ cmark_node *cmark_parse_file(FILE *f, int options);
 
 /** Render a 'node' tree as a commonmark document.
  * It is the caller's responsibility to free the returned buffer.
+ * If the document was parsed with `CMARK_OPT_RETAIN_SOURCE`, unchanged
+ * top-level blocks are copied from the source as written, unless 'width'
+ * or `CMARK_OPT_HARDBREAKS` / `CMARK_OPT_NOBREAKS` ask for line breaks
+ * to be reformatted.
  */
 CMARK_EXPORT
 char *cmark_render_commonmark(cmark_node *root, int options, int width);
 
+/**
+ * ## Text Layout
+ *
+ * The text of a leaf block flattened into a single string plus a list
+ * of style runs, for handing to native text layout in one piece.
+ */
+
+#define CMARK_STYLE_EMPH (1 << 0)
+#define CMARK_STYLE_STRONG (1 << 1)
+#define CMARK_STYLE_SUPER (1 << 2)
+#define CMARK_STYLE_SUB (1 << 3)
+#define CMARK_STYLE_STRIKE (1 << 4)
+#define CMARK_STYLE_CODE (1 << 5)
+#define CMARK_STYLE_LINK (1 << 6)
+/** Set on the alt text of an image. */
+#define CMARK_STYLE_IMAGE (1 << 7)
+
+/** A stretch of text sharing the same styles.
+ */
+typedef struct cmark_text_run {
+  /** Offset of the run in the layout's text, in code units. */
+  uint32_t start;
+  /** Length of the run, in code units. */
+  uint32_t length;
+  /** `CMARK_STYLE_*` bits. */
+  uint32_t style;
+  /** Index in `urls` of the innermost enclosing link or image, or -1. */
+  int32_t link;
+} cmark_text_run;
+
+typedef struct cmark_text_layout {
+  /** The text, NUL-terminated: UTF-8, or native-endian UTF-16 code units
+   * with `CMARK_OPT_LAYOUT_UTF16`.
+   */
+  const void *text;
+  /** Length of the text in code units, leaving out the terminator. */
+  size_t length;
+  /** Runs covering the text in order, adjacent ones always differing in
+   * style or link.
+   */
+  const cmark_text_run *runs;
+  size_t num_runs;
+  /** UTF-8 URLs of the links and images, in document order. */
+  const char *const *urls;
+  size_t num_urls;
+} cmark_text_layout;
+
+/** Lays out the text of a paragraph, heading or code block.  Soft line
+ * breaks become spaces, or newlines with `CMARK_OPT_HARDBREAKS`; hard
+ * line breaks become newlines.  Code blocks are a single code run
+ * without their final newline.  Returns NULL for other nodes.
+ * The layout, its runs, URLs and text are a single allocation made
+ * with the node's allocator; it is the caller's responsibility to free
+ * it.
+ */
+CMARK_EXPORT
+cmark_text_layout *cmark_render_layout(cmark_node *node, int options);
+
+/**
+ * ## Parse Cache
+ *
+ * A cache of parsed documents keyed by their input and options, for
+ * inputs that are parsed over and over.  Documents returned by the cache
+ * are shared between callers and must not be modified.  The cache may be
+ * used from several threads at once.
+ */
+
+/** Creates a cache that holds documents of up to about 'max_bytes' bytes
+ * in total, evicting the least recently used ones beyond that.
+ */
+CMARK_EXPORT
+cmark_cache *cmark_cache_new(size_t max_bytes);
+
+/** Frees the cache and its documents.  Every document obtained from it
+ * must have been released.
+ */
+CMARK_EXPORT
+void cmark_cache_free(cmark_cache *cache);
+
+/** Returns the document for 'buffer' parsed with 'options', parsing it
+ * only if it isn't cached.  `CMARK_OPT_LAZY_INLINES` is ignored.  The
+ * document must be handed back with `cmark_cache_release` instead of
+ * being freed.
+ */
+CMARK_EXPORT
+cmark_node *cmark_cache_parse(cmark_cache *cache, const char *buffer,
+                              size_t len, int options);
+
+/** Releases a document returned by `cmark_cache_parse`.  It's freed
+ * once it's been evicted and every reference to it is released.
+ */
+CMARK_EXPORT
+void cmark_cache_release(cmark_cache *cache, cmark_node *document);
+
+/** Returns the number of bytes currently charged against the cache.
+ */
+CMARK_EXPORT
+size_t cmark_cache_get_size(cmark_cache *cache);
+
+/**
+ * ## Tree Diffing
+ *
+ * An edit script turning one tree into another, made of block- and
+ * inline-level edits.  Subtrees with equal hashes (see
+ * `cmark_node_get_hash`) are matched without being descended into, so
+ * the work done is roughly proportional to the size of the changes.
+ */
+
+typedef enum {
+  /** 'old' was removed, along with its children. */
+  CMARK_DIFF_DELETE = 1,
+  /** 'new' was added, along with its children. */
+  CMARK_DIFF_INSERT,
+  /** 'old' became 'new', a node of the same type whose own content
+   * (literal, URL, heading level, ...) differs.  Changes to their
+   * children are listed separately.
+   */
+  CMARK_DIFF_UPDATE
+} cmark_diff_op;
+
+/** Computes the edits turning the tree rooted at 'a' into the tree
+ * rooted at 'b', in document order.  Edits refer to the nodes of both
+ * trees, which must outlive the returned script and not be modified
+ * while it's in use.  Free the script with `cmark_diff_free`.
+ */
+CMARK_EXPORT
+cmark_diff *cmark_node_diff(cmark_node *a, cmark_node *b);
+
+/** Frees an edit script.
+ */
+CMARK_EXPORT
+void cmark_diff_free(cmark_diff *diff);
+
+/** Returns the number of edits in 'diff', 0 if the trees are equal.
+ */
+CMARK_EXPORT
+size_t cmark_diff_get_length(cmark_diff *diff);
+
+/** Returns the kind of the edit at 'index', or 0 if out of range.
+ */
+CMARK_EXPORT
+cmark_diff_op cmark_diff_get_op(cmark_diff *diff, size_t index);
+
+/** Returns the node of the old tree affected by the edit at 'index', or
+ * NULL for insertions.
+ */
+CMARK_EXPORT
+cmark_node *cmark_diff_get_old(cmark_diff *diff, size_t index);
+
+/** Returns the node of the new tree affected by the edit at 'index', or
+ * NULL for deletions.
+ */
+CMARK_EXPORT
+cmark_node *cmark_diff_get_new(cmark_diff *diff, size_t index);
+
 /**
  * ## Options
  */
@@ -569,6 +960,11 @@ char *cmark_render_commonmark(cmark_node *root, int options, int width);
  */
 #define CMARK_OPT_NOBREAKS (1 << 4)
 
+/** Have `cmark_render_layout` produce UTF-16 text, with run offsets in
+ * UTF-16 code units.
+ */
+#define CMARK_OPT_LAYOUT_UTF16 (1 << 18)
+
 /**
  * ### Options affecting parsing
  */
@@ -586,6 +982,63 @@ char *cmark_render_commonmark(cmark_node *root, int options, int width);
  */
 #define CMARK_OPT_SMART (1 << 10)
 
+/** Defer inline parsing of paragraphs and headings until their children
+ * are first accessed through `cmark_node_first_child`,
+ * `cmark_node_last_child` or an iterator.  The document keeps its link
+ * reference definitions and parse options alive for that purpose.
+ * Blocks unlinked from the document or moved elsewhere have their
+ * inlines parsed first, with the document's definitions and options.
+ * Useful when large parts of a document, such as collapsed spoilers,
+ * are never rendered.  Only applies when parsing into a document node.
+ */
+#define CMARK_OPT_LAZY_INLINES (1 << 11)
+
+/** Compute the structural hash of every node (see `cmark_node_get_hash`)
+ * while parsing.  Has no effect together with `CMARK_OPT_LAZY_INLINES`,
+ * or in lean builds (`CMARK_LEAN_NODES`), which don't cache hashes.
+ */
+#define CMARK_OPT_NODE_HASHES (1 << 12)
+
+/** Keep a copy of the input with the document, so that
+ * `cmark_render_commonmark` can copy top-level blocks that haven't
+ * changed since parsing straight from the source instead of rendering
+ * them.  Blocks with links defined by link reference definitions are
+ * always rendered.  Inlines are parsed eagerly, as if
+ * `CMARK_OPT_LAZY_INLINES` weren't set.  Has no effect in lean builds
+ * (`CMARK_LEAN_NODES`), which don't track source positions.
+ */
+#define CMARK_OPT_RETAIN_SOURCE (1 << 13)
+
+/** Record where each line of the input starts, for
+ * `cmark_document_get_byte_offset` and `cmark_document_get_utf16_offset`.
+ * Has no effect in lean builds (`CMARK_LEAN_NODES`), which don't track
+ * source positions.
+ */
+#define CMARK_OPT_SOURCE_OFFSETS (1 << 19)
+
+/** Gather a `cmark_document_summary` of the document while parsing, see
+ * `cmark_document_get_summary`.  Inlines are parsed eagerly, as if
+ * `CMARK_OPT_LAZY_INLINES` weren't set.  Only applies when parsing into
+ * a document node.
+ */
+#define CMARK_OPT_DOCUMENT_SUMMARY (1 << 14)
+
+/** Turn Lemmy mentions, `@user@instance` and `!community@instance`, into
+ * links to `/u/user@instance` and `/c/community@instance`.  Names are
+ * letters, digits and underscores; instances are domain names with at
+ * least one dot.  Mentions must not directly follow a name character,
+ * so that e-mail addresses are left alone.  See `cmark_node_get_mention`.
+ */
+#define CMARK_OPT_MENTIONS (1 << 15)
+
+/** Turn bare URLs starting with `http://`, `https://` or `www.` into
+ * links, following the extended autolink rules of GitHub Flavored
+ * Markdown: the URL must be at the start of a word, its domain must
+ * contain a dot, and trailing punctuation and unbalanced closing
+ * parentheses are left out of it.  `www.` links point to `http://`.
+ */
+#define CMARK_OPT_AUTOLINK_URLS (1 << 16)
+
 /**
  * ## Version information
  */
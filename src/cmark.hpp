@@ -0,0 +1,434 @@
+#ifndef CMARK_HPP
+#define CMARK_HPP
+
+/** # NAME
+ *
+ * **cmark.hpp** - C++17 wrapper around the cmark C API
+ *
+ * Header only: include it and link against the cmark library.  Documents
+ * and parsers own their C counterparts and are move-only; nodes are plain
+ * views into a document and stay valid as long as it does.
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "cmark.h"
+
+namespace cmark {
+
+namespace detail {
+
+// cmark_mem has no context pointer, so allocations made through a
+// std::pmr::memory_resource carry a header naming their resource and
+// size.  New allocations go to the resource of the innermost
+// ResourceScope on this thread, or the default resource outside of one.
+struct alloc_header {
+  std::pmr::memory_resource *resource;
+  std::size_t size;
+};
+
+constexpr std::size_t header_size =
+    (sizeof(alloc_header) + alignof(std::max_align_t) - 1) /
+    alignof(std::max_align_t) * alignof(std::max_align_t);
+
+inline thread_local std::pmr::memory_resource *current_resource = nullptr;
+
+class ResourceScope {
+public:
+  explicit ResourceScope(std::pmr::memory_resource *resource)
+      : previous_(current_resource) {
+    if (resource) {
+      current_resource = resource;
+    }
+  }
+  ~ResourceScope() { current_resource = previous_; }
+
+  ResourceScope(const ResourceScope &) = delete;
+  ResourceScope &operator=(const ResourceScope &) = delete;
+
+private:
+  std::pmr::memory_resource *previous_;
+};
+
+inline alloc_header *header_of(void *ptr) {
+  return reinterpret_cast<alloc_header *>(static_cast<unsigned char *>(ptr) -
+                                          header_size);
+}
+
+inline void *pmr_allocate(std::pmr::memory_resource *resource,
+                          std::size_t size) {
+  void *block;
+  try {
+    block = resource->allocate(header_size + size, alignof(std::max_align_t));
+  } catch (...) {
+    std::fprintf(stderr, "[cmark] memory resource failed, aborting\n");
+    std::abort();
+  }
+  alloc_header *header = static_cast<alloc_header *>(block);
+  header->resource = resource;
+  header->size = size;
+  return static_cast<unsigned char *>(block) + header_size;
+}
+
+inline void pmr_free(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  alloc_header *header = header_of(ptr);
+  header->resource->deallocate(header, header_size + header->size,
+                               alignof(std::max_align_t));
+}
+
+inline void *pmr_calloc(std::size_t nmem, std::size_t size) {
+  if (size != 0 && nmem > (std::size_t)-1 / size) {
+    std::fprintf(stderr, "[cmark] calloc size overflow, aborting\n");
+    std::abort();
+  }
+  std::pmr::memory_resource *resource =
+      current_resource ? current_resource : std::pmr::get_default_resource();
+  void *ptr = pmr_allocate(resource, nmem * size);
+  std::memset(ptr, 0, nmem * size);
+  return ptr;
+}
+
+inline void *pmr_realloc(void *ptr, std::size_t size) {
+  if (ptr == nullptr) {
+    std::pmr::memory_resource *resource =
+        current_resource ? current_resource
+                         : std::pmr::get_default_resource();
+    return pmr_allocate(resource, size);
+  }
+  alloc_header *header = header_of(ptr);
+  void *new_ptr = pmr_allocate(header->resource, size);
+  std::memcpy(new_ptr, ptr, header->size < size ? header->size : size);
+  pmr_free(ptr);
+  return new_ptr;
+}
+
+} // namespace detail
+
+/** Returns an allocator that serves cmark's allocations from
+ * std::pmr memory resources.  Parser and Document select the resource
+ * they were given for every call they make.
+ */
+inline cmark_mem *pmr_mem_allocator() {
+  static cmark_mem mem = {detail::pmr_calloc, detail::pmr_realloc,
+                          detail::pmr_free};
+  return &mem;
+}
+
+/** A non-owning view of a node.  A default constructed Node is null.
+ */
+class Node {
+public:
+  class ChildIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Node;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Node;
+
+    explicit ChildIterator(cmark_node *node = nullptr) : node_(node) {}
+
+    Node operator*() const { return Node(node_); }
+    ChildIterator &operator++() {
+      node_ = cmark_node_next(node_);
+      return *this;
+    }
+    ChildIterator operator++(int) {
+      ChildIterator prev = *this;
+      ++*this;
+      return prev;
+    }
+    bool operator==(const ChildIterator &other) const {
+      return node_ == other.node_;
+    }
+    bool operator!=(const ChildIterator &other) const {
+      return node_ != other.node_;
+    }
+
+  private:
+    cmark_node *node_;
+  };
+
+  class Children {
+  public:
+    explicit Children(cmark_node *parent) : parent_(parent) {}
+    ChildIterator begin() const {
+      return ChildIterator(cmark_node_first_child(parent_));
+    }
+    ChildIterator end() const { return ChildIterator(); }
+
+  private:
+    cmark_node *parent_;
+  };
+
+  Node() : node_(nullptr) {}
+  explicit Node(cmark_node *node) : node_(node) {}
+
+  cmark_node *get() const { return node_; }
+  explicit operator bool() const { return node_ != nullptr; }
+  bool operator==(const Node &other) const { return node_ == other.node_; }
+  bool operator!=(const Node &other) const { return node_ != other.node_; }
+
+  cmark_node_type type() const { return cmark_node_get_type(node_); }
+  std::string_view type_string() const {
+    return cmark_node_get_type_string(node_);
+  }
+
+  Node parent() const { return Node(cmark_node_parent(node_)); }
+  Node next() const { return Node(cmark_node_next(node_)); }
+  Node previous() const { return Node(cmark_node_previous(node_)); }
+  Node first_child() const { return Node(cmark_node_first_child(node_)); }
+  Node last_child() const { return Node(cmark_node_last_child(node_)); }
+
+  /** Range over the children of this node, for use in range-for.
+   */
+  Children children() const { return Children(node_); }
+
+  /** String accessors return an empty view if the node has no such
+   * property.  Views point into the node and are invalidated when it is
+   * modified or freed.
+   */
+  std::string_view literal() const {
+    std::size_t len;
+    const char *str = cmark_node_get_literal_n(node_, &len);
+    return str ? std::string_view(str, len) : std::string_view();
+  }
+  std::string_view url() const {
+    std::size_t len;
+    const char *str = cmark_node_get_url_n(node_, &len);
+    return str ? std::string_view(str, len) : std::string_view();
+  }
+  std::string_view title() const {
+    std::size_t len;
+    const char *str = cmark_node_get_title_n(node_, &len);
+    return str ? std::string_view(str, len) : std::string_view();
+  }
+  std::string_view fence_info() const {
+    std::size_t len;
+    const char *str = cmark_node_get_fence_info_n(node_, &len);
+    return str ? std::string_view(str, len) : std::string_view();
+  }
+
+  int heading_level() const { return cmark_node_get_heading_level(node_); }
+  cmark_list_type list_type() const { return cmark_node_get_list_type(node_); }
+  int list_start() const { return cmark_node_get_list_start(node_); }
+  bool list_tight() const { return cmark_node_get_list_tight(node_) != 0; }
+
+private:
+  cmark_node *node_;
+};
+
+/** An event produced while walking a tree.
+ */
+struct Event {
+  cmark_event_type type;
+  Node node;
+};
+
+/** A single-pass range over the events of a cmark_iter.  Move-only.
+ */
+class Events {
+public:
+  class Iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Event;
+
+    Iterator() : iter_(nullptr), type_(CMARK_EVENT_DONE) {}
+    explicit Iterator(cmark_iter *iter) : iter_(iter) { ++*this; }
+
+    Event operator*() const {
+      return Event{type_, Node(cmark_iter_get_node(iter_))};
+    }
+    Iterator &operator++() {
+      type_ = cmark_iter_next(iter_);
+      return *this;
+    }
+    bool operator==(const Iterator &other) const {
+      return type_ == other.type_;
+    }
+    bool operator!=(const Iterator &other) const {
+      return type_ != other.type_;
+    }
+
+  private:
+    cmark_iter *iter_;
+    cmark_event_type type_;
+  };
+
+  Events(cmark_node *root, std::pmr::memory_resource *resource)
+      : resource_(resource) {
+    detail::ResourceScope scope(resource_);
+    iter_ = cmark_iter_new(root);
+  }
+  Events(Events &&other) noexcept
+      : iter_(std::exchange(other.iter_, nullptr)), resource_(other.resource_) {
+  }
+  Events &operator=(Events &&other) noexcept {
+    std::swap(iter_, other.iter_);
+    std::swap(resource_, other.resource_);
+    return *this;
+  }
+  ~Events() {
+    if (iter_) {
+      cmark_iter_free(iter_);
+    }
+  }
+
+  Iterator begin() { return Iterator(iter_); }
+  Iterator end() { return Iterator(); }
+
+private:
+  cmark_iter *iter_;
+  std::pmr::memory_resource *resource_;
+};
+
+/** An owned document tree.  Move-only; frees the tree when destroyed.
+ */
+class Document {
+public:
+  Document() : root_(nullptr), resource_(nullptr) {}
+
+  /** Takes ownership of 'root', which must have been allocated from
+   * 'resource' through pmr_mem_allocator(), or with cmark's own
+   * allocators if 'resource' is null.
+   */
+  explicit Document(cmark_node *root,
+                    std::pmr::memory_resource *resource = nullptr)
+      : root_(root), resource_(resource) {}
+
+  Document(Document &&other) noexcept
+      : root_(std::exchange(other.root_, nullptr)),
+        resource_(other.resource_) {}
+  Document &operator=(Document &&other) noexcept {
+    std::swap(root_, other.root_);
+    std::swap(resource_, other.resource_);
+    return *this;
+  }
+  Document(const Document &) = delete;
+  Document &operator=(const Document &) = delete;
+  ~Document() {
+    if (root_) {
+      cmark_node_free(root_);
+    }
+  }
+
+  /** Parses 'text' with cmark's default allocator.
+   */
+  static Document parse(std::string_view text,
+                        int options = CMARK_OPT_DEFAULT) {
+    return Document(cmark_parse_document(text.data(), text.size(), options));
+  }
+
+  cmark_node *get() const { return root_; }
+  explicit operator bool() const { return root_ != nullptr; }
+
+  /** Returns a copy sharing this document's strings; see
+   * cmark_node_clone.  This document must outlive the copy.
+   */
+  Document clone() const {
+    detail::ResourceScope scope(resource_);
+    return Document(cmark_node_clone(root_), resource_);
+  }
+
+  /** Gives up ownership of the tree and returns it.
+   */
+  cmark_node *release() { return std::exchange(root_, nullptr); }
+
+  Node root() const { return Node(root_); }
+  Node::Children children() const { return Node::Children(root_); }
+
+  /** Walks the whole tree, for use in range-for.
+   */
+  Events events() const { return Events(root_, resource_); }
+
+  /** Renders the document as CommonMark.
+   */
+  std::string commonmark(int options = CMARK_OPT_DEFAULT,
+                         int width = 0) const {
+    detail::ResourceScope scope(resource_);
+    char *result = cmark_render_commonmark(root_, options, width);
+    std::string out(result);
+    mem()->free(result);
+    return out;
+  }
+
+private:
+  cmark_mem *mem() const {
+    return resource_ ? pmr_mem_allocator() : cmark_get_default_mem_allocator();
+  }
+
+  cmark_node *root_;
+  std::pmr::memory_resource *resource_;
+};
+
+/** A streaming parser.  Move-only.  If given a memory resource, the
+ * parser and the documents it produces allocate from it.
+ */
+class Parser {
+public:
+  explicit Parser(int options = CMARK_OPT_DEFAULT,
+                  std::pmr::memory_resource *resource = nullptr)
+      : resource_(resource) {
+    if (resource_) {
+      detail::ResourceScope scope(resource_);
+      parser_ = cmark_parser_new_with_mem(options, pmr_mem_allocator());
+    } else {
+      parser_ = cmark_parser_new(options);
+    }
+  }
+
+  Parser(Parser &&other) noexcept
+      : parser_(std::exchange(other.parser_, nullptr)),
+        resource_(other.resource_) {}
+  Parser &operator=(Parser &&other) noexcept {
+    std::swap(parser_, other.parser_);
+    std::swap(resource_, other.resource_);
+    return *this;
+  }
+  Parser(const Parser &) = delete;
+  Parser &operator=(const Parser &) = delete;
+  ~Parser() {
+    if (parser_) {
+      cmark_parser_free(parser_);
+    }
+  }
+
+  cmark_parser *get() const { return parser_; }
+
+  void feed(std::string_view text) {
+    detail::ResourceScope scope(resource_);
+    cmark_parser_feed(parser_, text.data(), text.size());
+  }
+
+  /** Finishes the document fed so far and hands it over.  Call this
+   * once; the parser can't be fed again afterwards.
+   */
+  Document finish() {
+    detail::ResourceScope scope(resource_);
+    return Document(cmark_parser_finish(parser_), resource_);
+  }
+
+private:
+  cmark_parser *parser_;
+  std::pmr::memory_resource *resource_;
+};
+
+} // namespace cmark
+
+#endif
@@ -11,6 +11,7 @@
 #include "utf8.h"
 #include "scanners.h"
 #include "render.h"
+#include "source.h"
 
 #define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
 #define LIT(s) renderer->out(renderer, s, false, LITERAL)
@@ -151,11 +152,44 @@ static bool is_autolink(cmark_node *node) {
          strcmp((const char *)url, (char *)link_text->data) == 0;
 }
 
+#ifndef CMARK_LEAN_NODES
+// Copies a top-level block unchanged since parsing from the source kept
+// by CMARK_OPT_RETAIN_SOURCE.  Returns false if it has to be rendered.
+static bool S_render_source(cmark_renderer *renderer, cmark_node *node) {
+  const unsigned char *data;
+  bufsize_t len;
+
+  if (node->parent == NULL || node->parent->type != CMARK_NODE_DOCUMENT) {
+    return false;
+  }
+  // Rendered lists are indented further than most sources, and would
+  // swallow an indented code block following them.
+  if (node->type == CMARK_NODE_CODE_BLOCK && !node->as.code.fenced &&
+      node->prev && node->prev->type == CMARK_NODE_LIST) {
+    return false;
+  }
+  if (!cmark_source_get_span(node->parent->as.document.source, node, &data,
+                             &len)) {
+    return false;
+  }
+
+  cmark_render_verbatim(renderer, data, len);
+  if (node->type == CMARK_NODE_LIST && node->next &&
+      node->next->type == CMARK_NODE_LIST) {
+    CR();
+    LIT("<!-- end list -->");
+  }
+  BLANKLINE();
+  return true;
+}
+#endif
+
 static int S_render_node(cmark_renderer *renderer, cmark_node *node,
                          cmark_event_type ev_type, int options) {
   cmark_node *tmp;
   int list_number;
   cmark_delim_type list_delim;
+  cmark_mention_type mention;
   size_t numticks;
   bool extra_spaces;
   size_t i;
@@ -171,6 +205,15 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   bool allow_wrap = renderer->width > 0 && !(CMARK_OPT_NOBREAKS & options) &&
                     !(CMARK_OPT_HARDBREAKS & options);
 
+#ifndef CMARK_LEAN_NODES
+  if (entering && renderer->width <= 0 &&
+      !(options & (CMARK_OPT_HARDBREAKS | CMARK_OPT_NOBREAKS)) &&
+      S_render_source(renderer, node)) {
+    // Skip the node's contents.
+    return 0;
+  }
+#endif
+
   // Don't adjust tight list status til we've started the list.
   // Otherwise we lose the blank line between a paragraph and
   // a following list.
@@ -430,7 +473,15 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_LINK:
-    if (is_autolink(node)) {
+    mention = cmark_node_get_mention(node, NULL, NULL, NULL, NULL);
+    if (mention != CMARK_NO_MENTION) {
+      if (entering) {
+        // Written the way it was parsed; the URL holds the name.
+        LIT(mention == CMARK_USER_MENTION ? "@" : "!");
+        LIT(cmark_node_get_url(node) + 3);
+      }
+      return 0;
+    } else if (is_autolink(node)) {
       if (entering) {
         LIT("<");
         if (strncmp(cmark_node_get_url(node), "mailto:", 7) == 0) {
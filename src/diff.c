@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "cmark.h"
+#include "node.h"
+
+// Most cells of the table used to align two runs of children; longer runs
+// are only matched by position.
+#define MAX_LCS_CELLS ((size_t)1 << 20)
+
+// Work item comparing two nodes rather than recording an edit.
+#define DIFF_PAIR ((cmark_diff_op)0)
+
+typedef struct {
+  cmark_diff_op op;
+  cmark_node *old_node;
+  cmark_node *new_node;
+} cmark_diff_edit;
+
+typedef struct {
+  cmark_diff_edit *items;
+  size_t size;
+  size_t capacity;
+} edit_list;
+
+struct cmark_diff {
+  cmark_mem *mem;
+  edit_list edits;
+};
+
+static void S_push(cmark_mem *mem, edit_list *list, cmark_diff_op op,
+                   cmark_node *old_node, cmark_node *new_node) {
+  cmark_diff_edit *edit;
+
+  if (list->size == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->items = (cmark_diff_edit *)mem->realloc(
+        list->items, list->capacity * sizeof(cmark_diff_edit));
+  }
+  edit = &list->items[list->size++];
+  edit->op = op;
+  edit->old_node = old_node;
+  edit->new_node = new_node;
+}
+
+// Hash of the subtree rooted at 'node'.  cmark_node_diff has them all
+// computed up front, except in lean builds, which don't cache them.
+static inline uint64_t S_hash(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  return cmark_node_get_hash(node);
+#else
+  return node->hash;
+#endif
+}
+
+static cmark_node **S_children(cmark_mem *mem, cmark_node *node,
+                               uint64_t **hashes, size_t *count) {
+  cmark_node **children;
+  cmark_node *child;
+  size_t n = 0;
+
+  for (child = node->first_child; child; child = child->next) {
+    n++;
+  }
+  children = (cmark_node **)mem->calloc(n ? n : 1, sizeof(cmark_node *));
+  *hashes = (uint64_t *)mem->calloc(n ? n : 1, sizeof(uint64_t));
+  n = 0;
+  for (child = node->first_child; child; child = child->next) {
+    (*hashes)[n] = S_hash(child);
+    children[n++] = child;
+  }
+  *count = n;
+  return children;
+}
+
+// Matches up two runs of children lying between aligned ones.  Nodes of
+// the same type at the same offset are compared; the rest are deleted
+// or inserted.
+static void S_diff_gap(cmark_mem *mem, edit_list *out, cmark_node **a,
+                       size_t na, cmark_node **b, size_t nb) {
+  size_t i;
+
+  for (i = 0; i < na && i < nb; i++) {
+    if (a[i]->type == b[i]->type) {
+      S_push(mem, out, DIFF_PAIR, a[i], b[i]);
+    } else {
+      S_push(mem, out, CMARK_DIFF_DELETE, a[i], NULL);
+      S_push(mem, out, CMARK_DIFF_INSERT, NULL, b[i]);
+    }
+  }
+  for (; i < na; i++) {
+    S_push(mem, out, CMARK_DIFF_DELETE, a[i], NULL);
+  }
+  for (; i < nb; i++) {
+    S_push(mem, out, CMARK_DIFF_INSERT, NULL, b[i]);
+  }
+}
+
+// Aligns the children of 'a' and 'b' on their longest common subsequence
+// of equal subtrees, and appends what's left to compare to 'out' in
+// document order.  The common prefix and suffix are skipped first, so
+// the quadratic alignment only sees the changed region.
+static void S_diff_children(cmark_mem *mem, edit_list *out, cmark_node *a,
+                            cmark_node *b) {
+  size_t n, m, prefix = 0, suffix = 0;
+  uint64_t *ah, *bh, *amh, *bmh;
+  cmark_node **ac = S_children(mem, a, &ah, &n);
+  cmark_node **bc = S_children(mem, b, &bh, &m);
+  cmark_node **am, **bm;
+  size_t na, nb;
+
+  while (prefix < n && prefix < m && ah[prefix] == bh[prefix]) {
+    prefix++;
+  }
+  while (suffix < n - prefix && suffix < m - prefix &&
+         ah[n - 1 - suffix] == bh[m - 1 - suffix]) {
+    suffix++;
+  }
+  am = ac + prefix;
+  bm = bc + prefix;
+  amh = ah + prefix;
+  bmh = bh + prefix;
+  na = n - prefix - suffix;
+  nb = m - prefix - suffix;
+
+  if (na && nb && na + 1 <= MAX_LCS_CELLS / (nb + 1)) {
+    // lcs[i * (nb + 1) + j] is the length of the longest common
+    // subsequence of am[i..] and bm[j..].
+    uint32_t *lcs =
+        (uint32_t *)mem->calloc((na + 1) * (nb + 1), sizeof(uint32_t));
+    size_t i, j, gap_a = 0, gap_b = 0;
+
+#define LCS(i, j) lcs[(i) * (nb + 1) + (j)]
+    for (i = na; i-- > 0;) {
+      for (j = nb; j-- > 0;) {
+        if (amh[i] == bmh[j]) {
+          LCS(i, j) = LCS(i + 1, j + 1) + 1;
+        } else if (LCS(i + 1, j) >= LCS(i, j + 1)) {
+          LCS(i, j) = LCS(i + 1, j);
+        } else {
+          LCS(i, j) = LCS(i, j + 1);
+        }
+      }
+    }
+
+    i = j = 0;
+    while (i < na && j < nb) {
+      if (amh[i] == bmh[j]) {
+        S_diff_gap(mem, out, am + gap_a, i - gap_a, bm + gap_b, j - gap_b);
+        gap_a = ++i;
+        gap_b = ++j;
+      } else if (LCS(i + 1, j) >= LCS(i, j + 1)) {
+        i++;
+      } else {
+        j++;
+      }
+    }
+#undef LCS
+    S_diff_gap(mem, out, am + gap_a, na - gap_a, bm + gap_b, nb - gap_b);
+    mem->free(lcs);
+  } else {
+    S_diff_gap(mem, out, am, na, bm, nb);
+  }
+
+  mem->free(ac);
+  mem->free(bc);
+  mem->free(ah);
+  mem->free(bh);
+}
+
+cmark_diff *cmark_node_diff(cmark_node *a, cmark_node *b) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_diff *diff = (cmark_diff *)mem->calloc(1, sizeof(cmark_diff));
+  edit_list stack = {NULL, 0, 0};
+  edit_list pending = {NULL, 0, 0};
+
+  diff->mem = mem;
+  if (a == NULL || b == NULL) {
+    if (a) {
+      S_push(mem, &diff->edits, CMARK_DIFF_DELETE, a, NULL);
+    } else if (b) {
+      S_push(mem, &diff->edits, CMARK_DIFF_INSERT, NULL, b);
+    }
+    return diff;
+  }
+
+#ifndef CMARK_LEAN_NODES
+  cmark_node_get_hash(a);
+  cmark_node_get_hash(b);
+#endif
+
+  // Depth-first, with work items pushed in reverse so that edits come
+  // out in document order.
+  S_push(mem, &stack, DIFF_PAIR, a, b);
+  while (stack.size) {
+    cmark_diff_edit item = stack.items[--stack.size];
+
+    if (item.op != DIFF_PAIR) {
+      S_push(mem, &diff->edits, item.op, item.old_node, item.new_node);
+      continue;
+    }
+    if (S_hash(item.old_node) == S_hash(item.new_node)) {
+      continue;
+    }
+    if (item.old_node->type != item.new_node->type) {
+      S_push(mem, &diff->edits, CMARK_DIFF_DELETE, item.old_node, NULL);
+      S_push(mem, &diff->edits, CMARK_DIFF_INSERT, NULL, item.new_node);
+      continue;
+    }
+    if (cmark_node_own_hash(item.old_node) !=
+        cmark_node_own_hash(item.new_node)) {
+      S_push(mem, &diff->edits, CMARK_DIFF_UPDATE, item.old_node,
+             item.new_node);
+    }
+
+    pending.size = 0;
+    S_diff_children(mem, &pending, item.old_node, item.new_node);
+    while (pending.size) {
+      cmark_diff_edit *next = &pending.items[--pending.size];
+      S_push(mem, &stack, next->op, next->old_node, next->new_node);
+    }
+  }
+
+  mem->free(stack.items);
+  mem->free(pending.items);
+  return diff;
+}
+
+void cmark_diff_free(cmark_diff *diff) {
+  if (diff == NULL) {
+    return;
+  }
+  diff->mem->free(diff->edits.items);
+  diff->mem->free(diff);
+}
+
+size_t cmark_diff_get_length(cmark_diff *diff) {
+  return diff ? diff->edits.size : 0;
+}
+
+static cmark_diff_edit *S_edit(cmark_diff *diff, size_t index) {
+  if (diff == NULL || index >= diff->edits.size) {
+    return NULL;
+  }
+  return &diff->edits.items[index];
+}
+
+cmark_diff_op cmark_diff_get_op(cmark_diff *diff, size_t index) {
+  cmark_diff_edit *edit = S_edit(diff, index);
+  return edit ? edit->op : (cmark_diff_op)0;
+}
+
+cmark_node *cmark_diff_get_old(cmark_diff *diff, size_t index) {
+  cmark_diff_edit *edit = S_edit(diff, index);
+  return edit ? edit->old_node : NULL;
+}
+
+cmark_node *cmark_diff_get_new(cmark_diff *diff, size_t index) {
+  cmark_diff_edit *edit = S_edit(diff, index);
+  return edit ? edit->new_node : NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef CMARK_HASH_H
+#define CMARK_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fast non-cryptographic 64-bit hashing, used for cache keys and node
+// hashes.  Not suitable where inputs may be chosen to collide.
+
+static inline uint64_t cmark_hash_mix(uint64_t h) {
+  h ^= h >> 32;
+  h *= 0xd6e8feb86659fd93ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+// Folds 'value' into the running hash 'h'.
+static inline uint64_t cmark_hash_combine(uint64_t h, uint64_t value) {
+  h = (h ^ value) * 0x9fb21c651e98df25ULL;
+  return h ^ (h >> 29);
+}
+
+// Hashes 'len' bytes eight at a time, starting from 'seed'.
+static inline uint64_t cmark_hash_bytes(const unsigned char *data, size_t len,
+                                        uint64_t seed) {
+  uint64_t h = seed ^ 0x9e3779b97f4a7c15ULL ^ (uint64_t)len;
+  uint64_t word;
+
+  while (len >= 8) {
+    memcpy(&word, data, 8);
+    h = cmark_hash_combine(h, word);
+    data += 8;
+    len -= 8;
+  }
+  word = 0;
+  if (len) {
+    memcpy(&word, data, len);
+  }
+  return cmark_hash_mix(cmark_hash_combine(h, word));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
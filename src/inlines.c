@@ -13,6 +13,15 @@
 #include "scanners.h"
 #include "inlines.h"
 
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CMARK_HAVE_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 static const char *EMDASH = "\xE2\x80\x94";
 static const char *ENDASH = "\xE2\x80\x93";
 static const char *ELLIPSES = "\xE2\x80\xA6";
@@ -32,9 +41,43 @@ static const char *RIGHTSINGLEQUOTE = "\xE2\x80\x99";
 
 #define MAXBACKTICKS 1000
 
+// Characters that may start something other than plain text:
+// "\r\n\\`&_*[]<!"
+// Mlem notes: added '~' and '^', and '@' for mentions
+static const int8_t SPECIAL_CHARS[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// SPECIAL_CHARS plus the smart punctuation characters " ' . -
+// Selected once per subject so that scanning text doesn't need to test
+// CMARK_OPT_SMART for every byte.
+static const int8_t SMART_SPECIAL_CHARS[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 1, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Delimiters and brackets live in a cmark_inline_pool. Delimiters are
+// linked by pool index (-1 for none); brackets form a plain stack.
 typedef struct delimiter {
-  struct delimiter *previous;
-  struct delimiter *next;
+  int previous;
+  int next;
   cmark_node *inl_text;
   bufsize_t position;
   bufsize_t length;
@@ -44,7 +87,6 @@ typedef struct delimiter {
 } delimiter;
 
 typedef struct bracket {
-  struct bracket *previous;
   cmark_node *inl_text;
   bufsize_t position;
   bool image;
@@ -61,36 +103,91 @@ typedef struct {
   int block_offset;
   int column_offset;
   cmark_reference_map *refmap;
+  const int8_t *special_chars;
+  cmark_inline_pool *pool;
   delimiter *last_delim;
+  int free_delim;
+  int num_delims;
   bracket *last_bracket;
-  bufsize_t backticks[MAXBACKTICKS + 1];
+  // The first this many brackets were opened outside the superscript or
+  // subscript being parsed and can't close inside it.
+  bufsize_t bracket_bottom;
+  // pool->backticks[n] is the position of the last closer of length n
+  // seen so far. Entries past backticks_size count as 0.
+  bufsize_t backticks_size;
   bool scanned_for_backticks;
   bool no_link_openers;
+  // Text node that following text is merged into while it is the last
+  // child of the block, and the allocated size of its data (0 if unknown).
+  cmark_node *text_run;
+  bufsize_t text_run_capacity;
+  // Set once delimiters or brackets were used: resolving them can leave
+  // text nodes next to each other.
+  bool merge_text;
+  // Set once a link was resolved through a reference definition.
+  bool used_references;
+  // Set once a bare URL or mention was linked.
+  bool found_links;
+  // Bare URL domains starting in this range are known not to scan.
+  bufsize_t url_fail_start;
+  bufsize_t url_fail_end;
+  // CMARK_OPT_DOCUMENT_SUMMARY counts, and whether the last character
+  // counted was part of a word.
+  cmark_document_summary *summary;
+  bool in_word;
 } subject;
 
 static inline bool S_is_line_end_char(char c) {
   return (c == '\n' || c == '\r');
 }
 
+// Returns the number of brackets on the stack.
+static inline bufsize_t S_bracket_count(subject *subj) {
+  return subj->last_bracket == NULL
+             ? 0
+             : (bufsize_t)(subj->last_bracket - subj->pool->brackets) + 1;
+}
+
 static delimiter *S_insert_emph(subject *subj, delimiter *opener,
                                 delimiter *closer);
 
 static int parse_inline(subject *subj, cmark_node *parent, int options);
 
+static void process_emphasis(subject *subj, bufsize_t stack_bottom);
+
 static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset, subject *e,
-                             cmark_chunk *chunk, cmark_reference_map *refmap);
-static bufsize_t subject_find_special_char(subject *subj, int options);
+                             cmark_chunk *chunk, cmark_reference_map *refmap,
+                             cmark_inline_pool *pool, int options);
+
+// Source column of a position in the subject. Columns are 1 based.
+static inline int subj_column(subject *subj, bufsize_t pos) {
+  return pos + 1 + subj->column_offset + subj->block_offset;
+}
+
+// End column of an inline; lean builds don't track source positions.
+static inline int node_end_column(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return 0;
+#else
+  return node->end_column;
+#endif
+}
 
 // Create an inline with a literal string value.
 static inline cmark_node *make_literal(subject *subj, cmark_node_type t,
                                        int start_column, int end_column) {
   cmark_node *e = (cmark_node *)subj->mem->calloc(1, sizeof(*e));
-  e->mem = subj->mem;
   e->type = (uint16_t)t;
+  e->mem = subj->mem;
+#ifdef CMARK_LEAN_NODES
+  (void)start_column;
+  (void)end_column;
+#else
   e->start_line = e->end_line = subj->line;
-  // columns are 1 based.
-  e->start_column = start_column + 1 + subj->column_offset + subj->block_offset;
-  e->end_column = end_column + 1 + subj->column_offset + subj->block_offset;
+  e->start_column = subj_column(subj, start_column);
+  e->end_column = subj_column(subj, end_column);
+#endif
   return e;
 }
 
@@ -153,19 +250,22 @@ static void append_child(cmark_node *node, cmark_node *child) {
 }
 
 // Duplicate a chunk by creating a copy of the buffer not by reusing the
-// buffer like cmark_chunk_dup does.
-static unsigned char *cmark_strdup(cmark_mem *mem, unsigned char *src) {
+// buffer like cmark_chunk_dup does. Stores the length of the copy in 'len'.
+static unsigned char *cmark_strdup(cmark_mem *mem, unsigned char *src,
+                                   bufsize_t *len) {
   if (src == NULL) {
+    *len = 0;
     return NULL;
   }
-  size_t len = strlen((char *)src);
-  unsigned char *data = (unsigned char *)mem->realloc(NULL, len + 1);
-  memcpy(data, src, len + 1);
+  size_t n = strlen((char *)src);
+  unsigned char *data = (unsigned char *)mem->realloc(NULL, n + 1);
+  memcpy(data, src, n + 1);
+  *len = (bufsize_t)n;
   return data;
 }
 
 static unsigned char *cmark_clean_autolink(cmark_mem *mem, cmark_chunk *url,
-                                           int is_email) {
+                                           int is_email, bufsize_t *len) {
   cmark_strbuf buf = CMARK_BUF_INIT(mem);
 
   cmark_chunk_trim(url);
@@ -174,6 +274,7 @@ static unsigned char *cmark_clean_autolink(cmark_mem *mem, cmark_chunk *url,
     cmark_strbuf_puts(&buf, "mailto:");
 
   houdini_unescape_html_f(&buf, url->data, url->len);
+  *len = buf.size;
   return cmark_strbuf_detach(&buf);
 }
 
@@ -181,18 +282,344 @@ static inline cmark_node *make_autolink(subject *subj, int start_column,
                                         int end_column, cmark_chunk url,
                                         int is_email) {
   cmark_node *link = make_simple(subj->mem, CMARK_NODE_LINK);
-  link->as.link.url = cmark_clean_autolink(subj->mem, &url, is_email);
+  if (subj->summary) {
+    subj->summary->links++;
+  }
+  link->as.link.url = cmark_clean_autolink(subj->mem, &url, is_email,
+                                           &link->as.link.url_len);
   link->as.link.title = NULL;
+#ifndef CMARK_LEAN_NODES
   link->start_line = link->end_line = subj->line;
   link->start_column = start_column + 1;
   link->end_column = end_column + 1;
+#endif
   append_child(link, make_str_with_entities(subj, start_column + 1, end_column - 1, &url));
   return link;
 }
 
+static inline bool is_mention_name_char(unsigned char c) {
+  return cmark_isalpha(c) || cmark_isdigit(c) || c == '_';
+}
+
+// Scans "name@instance" at 'pos': a name of letters, digits and
+// underscores, and a domain of at least two labels.  Returns its length,
+// or 0 if there is none, and stores the length of the name in 'name_len'.
+static bufsize_t scan_mention(cmark_chunk *input, bufsize_t pos,
+                              bufsize_t *name_len) {
+  bufsize_t p = pos, end = 0;
+  int labels = 0;
+
+  while (p < input->len && is_mention_name_char(input->data[p])) {
+    p++;
+  }
+  if (p == pos || p >= input->len || input->data[p] != '@') {
+    return 0;
+  }
+  *name_len = p - pos;
+  p++;
+
+  // Labels start with a letter or digit; a trailing dot ends the mention.
+  while (p < input->len && (cmark_isalpha(input->data[p]) ||
+                            cmark_isdigit(input->data[p]))) {
+    while (p < input->len && (cmark_isalpha(input->data[p]) ||
+                              cmark_isdigit(input->data[p]) ||
+                              input->data[p] == '-')) {
+      p++;
+    }
+    labels++;
+    end = p;
+    if (p < input->len && input->data[p] == '.') {
+      p++;
+    } else {
+      break;
+    }
+  }
+
+  return labels >= 2 ? end - pos : 0;
+}
+
+// Makes a link from the mention spanning 'len' bytes at 'start', sigil
+// included.
+static cmark_node *make_mention(subject *subj, bufsize_t start,
+                                bufsize_t len, bool community) {
+  cmark_node *link = make_simple(subj->mem, CMARK_NODE_LINK);
+  cmark_strbuf url = CMARK_BUF_INIT(subj->mem);
+
+  cmark_strbuf_puts(&url, community ? "/c/" : "/u/");
+  cmark_strbuf_put(&url, subj->input.data + start + 1, len - 1);
+  link->as.link.url_len = url.size;
+  link->as.link.url = cmark_strbuf_detach(&url);
+  link->flags |= community ? CMARK_NODE__COMMUNITY_MENTION
+                           : CMARK_NODE__USER_MENTION;
+#ifndef CMARK_LEAN_NODES
+  link->start_line = link->end_line = subj->line;
+  link->start_column = subj_column(subj, start);
+  link->end_column = subj_column(subj, start + len - 1);
+#endif
+  append_child(link, make_str(subj, start, start + len - 1,
+                              cmark_chunk_dup(&subj->input, start, len)));
+  if (subj->summary) {
+    subj->summary->links++;
+  }
+  subj->found_links = true;
+  return link;
+}
+
+// Parses a Lemmy mention, "@user@instance" or "!community@instance", at
+// the current position.  Returns NULL without advancing if there is none.
+static cmark_node *handle_mention(subject *subj) {
+  bufsize_t start = subj->pos;
+  bufsize_t name_len, matchlen;
+
+  // Leave e-mail addresses and the like alone.
+  if (start > 0 && is_mention_name_char(subj->input.data[start - 1])) {
+    return NULL;
+  }
+  matchlen = scan_mention(&subj->input, start + 1, &name_len);
+  if (matchlen == 0) {
+    return NULL;
+  }
+  subj->pos = start + 1 + matchlen;
+  return make_mention(subj, start, matchlen + 1,
+                      subj->input.data[start] == '!');
+}
+
+// Returns the first position in [pos, end) that holds ':' or 'w', where
+// a bare URL might be found, or 'end'.
+static bufsize_t find_url_candidate(const unsigned char *data, bufsize_t pos,
+                                    bufsize_t end) {
+#ifdef CMARK_HAVE_SSE2
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i w = _mm_set1_epi8('w');
+
+  while (end - pos >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, colon),
+                                              _mm_cmpeq_epi8(chunk, w)));
+    if (mask) {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward(&index, (unsigned long)mask);
+      return pos + (bufsize_t)index;
+#else
+      return pos + __builtin_ctz((unsigned)mask);
+#endif
+    }
+    pos += 16;
+  }
+#endif
+  while (pos < end && data[pos] != ':' && data[pos] != 'w') {
+    pos++;
+  }
+  return pos;
+}
+
+// Compares 'len' bytes at 'data' with the lowercase 'scheme', ignoring
+// case.
+static bool is_scheme(const unsigned char *data, const char *scheme,
+                      bufsize_t len) {
+  bufsize_t i;
+
+  for (i = 0; i < len; i++) {
+    if ((data[i] | 0x20) != (unsigned char)scheme[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Bare URLs must start at the beginning of the input, after whitespace,
+// or after one of * _ ~ (
+static bool url_can_start(cmark_chunk *input, bufsize_t pos) {
+  unsigned char c;
+
+  if (pos == 0) {
+    return true;
+  }
+  c = input->data[pos - 1];
+  return cmark_isspace(c) || c == '*' || c == '_' || c == '~' || c == '(';
+}
+
+// Scans the domain of a bare URL at 'pos': labels of letters, digits,
+// underscores and hyphens separated by dots, with at least one dot and no
+// underscores in the last two labels.  Returns its length, or 0.  A scan
+// starting further into the same domain stops at the same place, so on
+// failure '*fail_end' is set to the last start that fails the same way.
+static bufsize_t scan_url_domain(cmark_chunk *input, bufsize_t pos,
+                                 bufsize_t *fail_end) {
+  bufsize_t p = pos, label = pos, prev_label = pos;
+  int dots = 0;
+
+  while (p < input->len) {
+    unsigned char c = input->data[p];
+    if (c == '.') {
+      if (p + 1 >= input->len || !(cmark_isalpha(input->data[p + 1]) ||
+                                   cmark_isdigit(input->data[p + 1]) ||
+                                   input->data[p + 1] == '_' ||
+                                   input->data[p + 1] == '-')) {
+        break;
+      }
+      dots++;
+      prev_label = label;
+      label = p + 1;
+    } else if (!cmark_isalpha(c) && !cmark_isdigit(c) && c != '_' &&
+               c != '-') {
+      break;
+    }
+    p++;
+  }
+  // Trailing underscores close emphasis rather than end the domain.
+  while (p > label && input->data[p - 1] == '_') {
+    p--;
+  }
+
+  if (dots == 0) {
+    *fail_end = p;
+    return 0;
+  }
+  if (p == label) {
+    *fail_end = label;
+    return 0;
+  }
+  if (memchr(input->data + prev_label, '_', p - prev_label)) {
+    *fail_end = prev_label;
+    return 0;
+  }
+  return p - pos;
+}
+
+// Returns the end of a bare URL whose domain ends at 'pos'.  The URL runs
+// to whitespace, '<', a backslash escape or, inside brackets, ']', less
+// trailing punctuation, unbalanced closing parentheses and entity
+// references.
+static bufsize_t scan_url_end(cmark_chunk *input, bufsize_t start,
+                              bufsize_t pos, bool in_brackets) {
+  bufsize_t end = pos, i;
+  int opening = 0, closing = 0;
+
+  while (end < input->len && !cmark_isspace(input->data[end]) &&
+         input->data[end] != '<' && input->data[end] != '\\' &&
+         !(in_brackets && input->data[end] == ']')) {
+    if (input->data[end] == '(') {
+      opening++;
+    } else if (input->data[end] == ')') {
+      closing++;
+    }
+    end++;
+  }
+
+  while (end > pos) {
+    unsigned char c = input->data[end - 1];
+    if (strchr("?!.,:*_~'\"", c)) {
+      end--;
+    } else if (c == ')' && closing > opening) {
+      closing--;
+      end--;
+    } else if (c == ';') {
+      for (i = end - 1; i > start && (cmark_isalpha(input->data[i - 1]) ||
+                                      cmark_isdigit(input->data[i - 1]));
+           i--) {
+      }
+      if (i > start && i < end - 1 && input->data[i - 1] == '&') {
+        end = i - 1;
+      } else {
+        break;
+      }
+    } else {
+      break;
+    }
+  }
+  return end;
+}
+
+// Looks for a bare URL in the text from the current position to '*end'.
+// Returns a link if one starts right here.  If one starts further on,
+// '*end' is moved to it, so that the text before is taken first.
+static cmark_node *handle_bare_url(subject *subj, bufsize_t *end) {
+  cmark_chunk *input = &subj->input;
+  bufsize_t pos = subj->pos;
+
+  while ((pos = find_url_candidate(input->data, pos, *end)) < *end) {
+    bufsize_t start, domain, domain_len;
+    bool www = input->data[pos] == 'w';
+
+    if (www) {
+      start = pos;
+      domain = pos;
+      if (input->len - pos < 4 || memcmp(input->data + pos, "www.", 4) != 0) {
+        pos++;
+        continue;
+      }
+    } else {
+      // "://" preceded by http or https.
+      if (input->len - pos < 3 || memcmp(input->data + pos, "://", 3) != 0) {
+        pos++;
+        continue;
+      }
+      if (pos - subj->pos >= 5 &&
+          is_scheme(input->data + pos - 5, "https", 5)) {
+        start = pos - 5;
+      } else if (pos - subj->pos >= 4 &&
+                 is_scheme(input->data + pos - 4, "http", 4)) {
+        start = pos - 4;
+      } else {
+        pos++;
+        continue;
+      }
+      domain = pos + 3;
+    }
+
+    if (!url_can_start(input, start) ||
+        (domain >= subj->url_fail_start && domain <= subj->url_fail_end)) {
+      pos++;
+      continue;
+    }
+    domain_len = scan_url_domain(input, domain, &subj->url_fail_end);
+    if (domain_len == 0) {
+      subj->url_fail_start = domain;
+      pos++;
+      continue;
+    }
+
+    if (start > subj->pos) {
+      *end = start;
+      return NULL;
+    } else {
+      bufsize_t url_end =
+          scan_url_end(input, start, domain + domain_len,
+                       S_bracket_count(subj) > subj->bracket_bottom);
+      cmark_chunk text = cmark_chunk_dup(input, start, url_end - start);
+      cmark_node *link = make_simple(subj->mem, CMARK_NODE_LINK);
+      cmark_strbuf url = CMARK_BUF_INIT(subj->mem);
+
+      link->flags |= CMARK_NODE__BARE_URL;
+      subj->found_links = true;
+      if (www) {
+        cmark_strbuf_puts(&url, "http://");
+      }
+      houdini_unescape_html_f(&url, text.data, text.len);
+      link->as.link.url_len = url.size;
+      link->as.link.url = cmark_strbuf_detach(&url);
+#ifndef CMARK_LEAN_NODES
+      link->start_line = link->end_line = subj->line;
+      link->start_column = subj_column(subj, start);
+      link->end_column = subj_column(subj, url_end - 1);
+#endif
+      append_child(link,
+                   make_str_with_entities(subj, start, url_end - 1, &text));
+      if (subj->summary) {
+        subj->summary->links++;
+      }
+      subj->pos = url_end;
+      return link;
+    }
+  }
+  return NULL;
+}
+
 static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset, subject *e,
-                             cmark_chunk *chunk, cmark_reference_map *refmap) {
-  int i;
+                             cmark_chunk *chunk, cmark_reference_map *refmap,
+                             cmark_inline_pool *pool, int options) {
   e->mem = mem;
   e->input = *chunk;
   e->flags = 0;
@@ -201,13 +628,52 @@ static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset,
   e->block_offset = block_offset;
   e->column_offset = 0;
   e->refmap = refmap;
+  e->special_chars =
+      (options & CMARK_OPT_SMART) ? SMART_SPECIAL_CHARS : SPECIAL_CHARS;
+  e->pool = pool;
   e->last_delim = NULL;
+  e->free_delim = -1;
+  e->num_delims = 0;
   e->last_bracket = NULL;
-  for (i = 0; i <= MAXBACKTICKS; i++) {
-    e->backticks[i] = 0;
-  }
+  e->bracket_bottom = 0;
+  e->backticks_size = 0;
   e->scanned_for_backticks = false;
   e->no_link_openers = true;
+  e->text_run = NULL;
+  e->text_run_capacity = 0;
+  e->merge_text = false;
+  e->used_references = false;
+  e->found_links = false;
+  e->url_fail_start = 0;
+  e->url_fail_end = -1;
+  e->summary = NULL;
+  e->in_word = false;
+}
+
+// Grows a pool array to hold at least 'needed' elements.
+static void *pool_reserve(cmark_mem *mem, void *ptr, bufsize_t *capacity,
+                          bufsize_t needed, size_t elem_size) {
+  if (needed > *capacity) {
+    bufsize_t new_capacity = *capacity ? *capacity : 8;
+    while (new_capacity < needed) {
+      new_capacity *= 2;
+    }
+    ptr = mem->realloc(ptr, new_capacity * elem_size);
+    *capacity = new_capacity;
+  }
+  return ptr;
+}
+
+void cmark_inline_pool_free(cmark_inline_pool *pool) {
+  pool->mem->free(pool->delimiters);
+  pool->mem->free(pool->brackets);
+  pool->mem->free(pool->backticks);
+  pool->delimiters = NULL;
+  pool->brackets = NULL;
+  pool->backticks = NULL;
+  pool->delimiters_capacity = 0;
+  pool->brackets_capacity = 0;
+  pool->backticks_capacity = 0;
 }
 
 static inline int isbacktick(int c) { return (c == '`'); }
@@ -267,6 +733,7 @@ static inline cmark_chunk take_while(subject *subj, int (*f)(int)) {
   return cmark_chunk_dup(&subj->input, startpos, len);
 }
 
+#ifndef CMARK_LEAN_NODES
 // Return the number of newlines in a given span of text in a subject.  If
 // the number is greater than zero, also return the number of characters
 // between the last newline and the end of the span in `since_newline`.
@@ -289,11 +756,19 @@ static int count_newlines(subject *subj, bufsize_t from, bufsize_t len, int *sin
   *since_newline = since_nl;
   return nls;
 }
+#endif
 
 // Adjust `node`'s `end_line`, `end_column`, and `subj`'s `line` and
 // `column_offset` according to the number of newlines in a just-matched span
 // of text in `subj`.
 static void adjust_subj_node_newlines(subject *subj, cmark_node *node, int matchlen, int extra, int options) {
+#ifdef CMARK_LEAN_NODES
+  (void)subj;
+  (void)node;
+  (void)matchlen;
+  (void)extra;
+  (void)options;
+#else
   if (!(options & CMARK_OPT_SOURCEPOS)) {
     return;
   }
@@ -306,6 +781,7 @@ static void adjust_subj_node_newlines(subject *subj, cmark_node *node, int match
     node->end_column = since_newline;
     subj->column_offset = -subj->pos + since_newline + extra;
   }
+#endif
 }
 
 // Try to process a backtick code span that began with a
@@ -322,7 +798,8 @@ static bufsize_t scan_to_closing_backticks(subject *subj,
     return 0;
   }
   if (subj->scanned_for_backticks &&
-      subj->backticks[openticklength] <= subj->pos) {
+      (openticklength >= subj->backticks_size ||
+       subj->pool->backticks[openticklength] <= subj->pos)) {
     // return if we already know there's no closer
     return 0;
   }
@@ -342,7 +819,16 @@ static bufsize_t scan_to_closing_backticks(subject *subj,
     }
     // store position of ender
     if (numticks <= MAXBACKTICKS) {
-      subj->backticks[numticks] = subj->pos - numticks;
+      cmark_inline_pool *pool = subj->pool;
+      if (numticks >= subj->backticks_size) {
+        pool->backticks = (bufsize_t *)pool_reserve(
+            subj->mem, pool->backticks, &pool->backticks_capacity,
+            numticks + 1, sizeof(bufsize_t));
+        memset(pool->backticks + subj->backticks_size, 0,
+               (numticks + 1 - subj->backticks_size) * sizeof(bufsize_t));
+        subj->backticks_size = numticks + 1;
+      }
+      pool->backticks[numticks] = subj->pos - numticks;
     }
     if (numticks == openticklength) {
       return (subj->pos);
@@ -492,74 +978,191 @@ static void print_delimiters(subject *subj)
         delimiter *delim;
         delim = subj->last_delim;
         while (delim != NULL) {
-                printf("Item at stack pos %p: %d %d %d next(%p) prev(%p)\n",
+                printf("Item at stack pos %p: %d %d %d next(%d) prev(%d)\n",
                        (void*)delim, delim->delim_char,
                        delim->can_open, delim->can_close,
-                       (void*)delim->next, (void*)delim->previous);
-                delim = delim->previous;
+                       delim->next, delim->previous);
+                delim = S_prev_delim(subj, delim);
         }
 }
 */
 
+static inline delimiter *S_delim_at(subject *subj, int index) {
+  return index < 0 ? NULL : &subj->pool->delimiters[index];
+}
+
+static inline int S_delim_index(subject *subj, delimiter *delim) {
+  return delim == NULL ? -1 : (int)(delim - subj->pool->delimiters);
+}
+
+static inline delimiter *S_prev_delim(subject *subj, delimiter *delim) {
+  return S_delim_at(subj, delim->previous);
+}
+
+static inline delimiter *S_next_delim(subject *subj, delimiter *delim) {
+  return S_delim_at(subj, delim->next);
+}
+
 static void remove_delimiter(subject *subj, delimiter *delim) {
   if (delim == NULL)
     return;
-  if (delim->next == NULL) {
+  if (delim->next < 0) {
     // end of list:
     assert(delim == subj->last_delim);
-    subj->last_delim = delim->previous;
+    subj->last_delim = S_prev_delim(subj, delim);
   } else {
-    delim->next->previous = delim->previous;
+    S_next_delim(subj, delim)->previous = delim->previous;
   }
-  if (delim->previous != NULL) {
-    delim->previous->next = delim->next;
+  if (delim->previous >= 0) {
+    S_prev_delim(subj, delim)->next = delim->next;
   }
-  subj->mem->free(delim);
+  // put the slot on the free list
+  delim->next = subj->free_delim;
+  subj->free_delim = S_delim_index(subj, delim);
 }
 
 static void pop_bracket(subject *subj) {
-  bracket *b;
   if (subj->last_bracket == NULL)
     return;
-  b = subj->last_bracket;
-  subj->last_bracket = subj->last_bracket->previous;
-  subj->mem->free(b);
+  if (subj->last_bracket == subj->pool->brackets) {
+    subj->last_bracket = NULL;
+  } else {
+    subj->last_bracket--;
+  }
 }
 
 static void push_delimiter(subject *subj, unsigned char c, bool can_open,
                            bool can_close, cmark_node *inl_text) {
-  delimiter *delim = (delimiter *)subj->mem->calloc(1, sizeof(delimiter));
+  cmark_inline_pool *pool = subj->pool;
+  int last = S_delim_index(subj, subj->last_delim);
+  int index;
+  delimiter *delim;
+
+  if (subj->free_delim >= 0) {
+    index = subj->free_delim;
+    subj->free_delim = pool->delimiters[index].next;
+  } else {
+    index = subj->num_delims++;
+    pool->delimiters = (delimiter *)pool_reserve(
+        subj->mem, pool->delimiters, &pool->delimiters_capacity,
+        subj->num_delims, sizeof(delimiter));
+  }
+
+  delim = &pool->delimiters[index];
   delim->delim_char = c;
   delim->can_open = can_open;
   delim->can_close = can_close;
   delim->inl_text = inl_text;
   delim->position = subj->pos;
   delim->length = inl_text->len;
-  delim->previous = subj->last_delim;
-  delim->next = NULL;
-  if (delim->previous != NULL) {
-    delim->previous->next = delim;
+  delim->previous = last;
+  delim->next = -1;
+  if (last >= 0) {
+    pool->delimiters[last].next = index;
   }
   subj->last_delim = delim;
+  subj->merge_text = true;
 }
 
 static void push_bracket(subject *subj, bool image, cmark_node *inl_text) {
-  bracket *b = (bracket *)subj->mem->calloc(1, sizeof(bracket));
+  cmark_inline_pool *pool = subj->pool;
+  bufsize_t index = 0;
+  bracket *b;
+
   if (subj->last_bracket != NULL) {
     subj->last_bracket->bracket_after = true;
+    index = (bufsize_t)(subj->last_bracket - pool->brackets) + 1;
   }
+  pool->brackets = (bracket *)pool_reserve(
+      subj->mem, pool->brackets, &pool->brackets_capacity, index + 1,
+      sizeof(bracket));
+
+  b = &pool->brackets[index];
   b->image = image;
   b->active = true;
   b->inl_text = inl_text;
-  b->previous = subj->last_bracket;
   b->position = subj->pos;
   b->bracket_after = false;
   subj->last_bracket = b;
+  subj->merge_text = true;
   if (!image) {
     subj->no_link_openers = false;
   }
 }
 
+// Parses a Lemmy superscript "^text^" or subscript "~text~" at the current
+// position.  The text runs to the next 'c' that isn't escaped or inside a
+// code span, and may not be empty or contain whitespace.  Finding the
+// closer first means these spans never need the delimiter stack; their
+// text is then parsed as inlines of its own, which brackets and emphasis
+// from outside can't reach into.  Returns NULL without advancing if there
+// is no closer.
+static cmark_node *handle_script(subject *subj, unsigned char c,
+                                 int options) {
+  const unsigned char *data = subj->input.data;
+  bufsize_t start = subj->pos;
+  bufsize_t p = start + 1;
+  bufsize_t code_end = 0;
+  bufsize_t input_len = subj->input.len;
+  bufsize_t bracket_bottom = subj->bracket_bottom;
+  bool no_link_openers = subj->no_link_openers;
+  bool scanned_for_backticks;
+  cmark_node *node;
+
+  while (p < input_len && (data[p] != c || p < code_end)) {
+    if (cmark_isspace(data[p])) {
+      return NULL;
+    }
+    if (p >= code_end && data[p] == '`') {
+      bufsize_t ticks = p;
+      while (p < input_len && data[p] == '`') {
+        p++;
+      }
+      subj->pos = p;
+      code_end = scan_to_closing_backticks(subj, p - ticks);
+      subj->pos = start;
+      continue;
+    }
+    if (p >= code_end && data[p] == '\\' && p + 1 < input_len &&
+        cmark_ispunct(data[p + 1])) {
+      p++;
+    }
+    p++;
+  }
+  if (p >= input_len || p == start + 1) {
+    return NULL;
+  }
+
+  node = c == '^' ? make_super(subj->mem) : make_sub(subj->mem);
+#ifndef CMARK_LEAN_NODES
+  node->start_line = node->end_line = subj->line;
+  node->start_column = subj_column(subj, start);
+  node->end_column = subj_column(subj, p);
+#endif
+
+  // Parse the text with the subject cut off at the closer.  A scan for
+  // code span closers that stops there says nothing about the rest of
+  // the input, so it isn't remembered.
+  scanned_for_backticks = subj->scanned_for_backticks;
+  subj->input.len = p;
+  subj->pos = start + 1;
+  subj->bracket_bottom = S_bracket_count(subj);
+  subj->text_run = NULL;
+  while (!is_eof(subj) && parse_inline(subj, node, options))
+    ;
+  process_emphasis(subj, start + 1);
+  while (S_bracket_count(subj) > subj->bracket_bottom) {
+    pop_bracket(subj);
+  }
+  subj->bracket_bottom = bracket_bottom;
+  subj->no_link_openers = subj->no_link_openers || no_link_openers;
+  subj->scanned_for_backticks = scanned_for_backticks;
+  subj->input.len = input_len;
+  subj->text_run = NULL;
+  subj->pos = p + 1;
+  return node;
+}
+
 // Assumes the subject has a c at the current position.
 static cmark_node *handle_delim(subject *subj, unsigned char c, bool smart) {
   bufsize_t numdelims;
@@ -654,19 +1257,19 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
   bool opener_found;
   int openers_bottom_index = 0;
 
-  bufsize_t openers_bottom[21] = {stack_bottom, stack_bottom, stack_bottom,
+  bufsize_t openers_bottom[20] = {stack_bottom, stack_bottom, stack_bottom,
                                   stack_bottom, stack_bottom, stack_bottom,
                                   stack_bottom, stack_bottom, stack_bottom,
                                   stack_bottom, stack_bottom, stack_bottom,
                                   stack_bottom, stack_bottom, stack_bottom,
                                   stack_bottom, stack_bottom, stack_bottom,
-                                  stack_bottom, stack_bottom, stack_bottom};
+                                  stack_bottom, stack_bottom};
 
   // move back to first relevant delim.
   candidate = subj->last_delim;
   while (candidate != NULL && candidate->position >= stack_bottom) {
     closer = candidate;
-    candidate = candidate->previous;
+    candidate = S_prev_delim(subj, candidate);
   }
 
   // now move forward, looking for closers, and handling each
@@ -679,18 +1282,15 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
       case '\'':
         openers_bottom_index = 1;
         break;
-      case '^':
-        openers_bottom_index = 2;
-        break;
       case '~':
-        openers_bottom_index = 3 + (closer->can_open ? 3 : 0) + (closer->length % 3);
+        openers_bottom_index = 2 + (closer->can_open ? 3 : 0) + (closer->length % 3);
         break;
       case '_':
-        openers_bottom_index = 9 +
+        openers_bottom_index = 8 +
                 (closer->can_open ? 3 : 0) + (closer->length % 3);
         break;
       case '*':
-        openers_bottom_index = 15 +
+        openers_bottom_index = 14 +
                 (closer->can_open ? 3 : 0) + (closer->length % 3);
         break;
       default:
@@ -698,7 +1298,7 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
       }
 
       // Now look backwards for first matching opener:
-      opener = closer->previous;
+      opener = S_prev_delim(subj, closer);
       opener_found = false;
       while (opener != NULL &&
              opener->position >= openers_bottom[openers_bottom_index]) {
@@ -712,14 +1312,14 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
             break;
           }
         }
-        opener = opener->previous;
+        opener = S_prev_delim(subj, opener);
       }
       old_closer = closer;
-      if (closer->delim_char == '*' || closer->delim_char == '_' || closer->delim_char == '^' || closer->delim_char == '~') {
+      if (closer->delim_char == '*' || closer->delim_char == '_' || closer->delim_char == '~') {
         if (opener_found) {
           closer = S_insert_emph(subj, opener, closer);
         } else {
-          closer = closer->next;
+          closer = S_next_delim(subj, closer);
         }
       } else if (closer->delim_char == '\'' || closer->delim_char == '"') {
         if (closer->delim_char == '\'') {
@@ -727,7 +1327,7 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
         } else {
           cmark_node_set_literal(closer->inl_text, RIGHTDOUBLEQUOTE);
         }
-        closer = closer->next;
+        closer = S_next_delim(subj, closer);
         if (opener_found) {
           if (old_closer->delim_char == '\'') {
             cmark_node_set_literal(opener->inl_text, LEFTSINGLEQUOTE);
@@ -749,7 +1349,7 @@ static void process_emphasis(subject *subj, bufsize_t stack_bottom) {
         }
       }
     } else {
-      closer = closer->next;
+      closer = S_next_delim(subj, closer);
     }
   }
   // free all delimiters in list until stack_bottom:
@@ -781,9 +1381,9 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   closer_inl->data[closer_num_chars] = 0;
 
   // free delimiters between opener and closer
-  delim = closer->previous;
+  delim = S_prev_delim(subj, closer);
   while (delim != NULL && delim != opener) {
-    tmp_delim = delim->previous;
+    tmp_delim = S_prev_delim(subj, delim);
     remove_delimiter(subj, delim);
     delim = tmp_delim;
   }
@@ -791,9 +1391,6 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   // create new emph or strong, and splice it in to our inlines
   // between the opener and closer
   switch (opener->delim_char) {
-    case '^':
-      node = make_super(subj->mem);
-      break;
     case '~':
       node = use_delims == 1 ? make_sub(subj->mem) : make_strike(subj->mem);
       break;
@@ -823,10 +1420,12 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   node->next = closer_inl;
   node->parent = opener_inl->parent;
 
+#ifndef CMARK_LEAN_NODES
   node->start_line = opener_inl->start_line;
   node->end_line = closer_inl->end_line;
   node->start_column = opener_inl->start_column;
   node->end_column = closer_inl->end_column;
+#endif
 
   // if opener has 0 characters, remove it and its associated inline
   if (opener_num_chars == 0) {
@@ -839,7 +1438,7 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
     // remove empty closer inline
     cmark_node_free(closer_inl);
     // remove closer from list
-    tmp_delim = closer->next;
+    tmp_delim = S_next_delim(subj, closer);
     remove_delimiter(subj, closer);
     closer = tmp_delim;
   }
@@ -881,8 +1480,10 @@ static cmark_node *handle_entity(subject *subj) {
 }
 
 // Clean a URL: remove surrounding whitespace, and remove \ that escape
-// punctuation.
-unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url) {
+// punctuation. If 'len' isn't NULL, the length of the result is stored
+// there.
+unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url,
+                               bufsize_t *len) {
   cmark_strbuf buf = CMARK_BUF_INIT(mem);
 
   cmark_chunk_trim(url);
@@ -890,13 +1491,20 @@ unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url) {
   houdini_unescape_html_f(&buf, url->data, url->len);
 
   cmark_strbuf_unescape(&buf);
+  if (len) {
+    *len = buf.size;
+  }
   return cmark_strbuf_detach(&buf);
 }
 
-unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title) {
+unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title,
+                                 bufsize_t *len) {
   cmark_strbuf buf = CMARK_BUF_INIT(mem);
   unsigned char first, last;
 
+  if (len) {
+    *len = 0;
+  }
   if (title->len == 0) {
     return NULL;
   }
@@ -913,6 +1521,9 @@ unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title) {
   }
 
   cmark_strbuf_unescape(&buf);
+  if (len) {
+    *len = buf.size;
+  }
   return cmark_strbuf_detach(&buf);
 }
 
@@ -1063,6 +1674,34 @@ static bufsize_t manual_scan_link_url(cmark_chunk *input, bufsize_t offset,
   return i - offset;
 }
 
+// Turns the bare URLs and mentions in the text of 'link' back into text,
+// since links can't contain links.  Links don't nest, so each node is
+// visited once.
+static void unlink_found_links(subject *subj, cmark_node *link) {
+  const int found = CMARK_NODE__BARE_URL | CMARK_NODE__MENTION;
+  cmark_node *node = link->first_child, *next;
+
+  while (node != NULL) {
+    if (node->first_child && !(node->flags & found)) {
+      node = node->first_child;
+      continue;
+    }
+    for (next = node; next != link && next->next == NULL; next = next->parent)
+      ;
+    next = next == link ? NULL : next->next;
+    if (node->flags & found) {
+      while (node->first_child) {
+        cmark_node_insert_before(node, node->first_child);
+      }
+      cmark_node_free(node);
+      if (subj->summary) {
+        subj->summary->links--;
+      }
+    }
+    node = next;
+  }
+}
+
 // Return a link, an image, or a literal close bracket.
 static cmark_node *handle_close_bracket(subject *subj) {
   bufsize_t initial_pos, after_link_text_pos;
@@ -1071,6 +1710,7 @@ static cmark_node *handle_close_bracket(subject *subj) {
   cmark_reference *ref = NULL;
   cmark_chunk url_chunk, title_chunk;
   unsigned char *url, *title;
+  bufsize_t url_len, title_len;
   bracket *opener;
   cmark_node *inl;
   cmark_chunk raw_label;
@@ -1084,7 +1724,7 @@ static cmark_node *handle_close_bracket(subject *subj) {
   // get last [ or ![
   opener = subj->last_bracket;
 
-  if (opener == NULL) {
+  if (opener == NULL || S_bracket_count(subj) <= subj->bracket_bottom) {
     return make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("]"));
   }
 
@@ -1122,8 +1762,8 @@ static cmark_node *handle_close_bracket(subject *subj) {
 
       title_chunk =
           cmark_chunk_dup(&subj->input, starttitle, endtitle - starttitle);
-      url = cmark_clean_url(subj->mem, &url_chunk);
-      title = cmark_clean_title(subj->mem, &title_chunk);
+      url = cmark_clean_url(subj->mem, &url_chunk, &url_len);
+      title = cmark_clean_title(subj->mem, &title_chunk, &title_len);
       cmark_chunk_free(&url_chunk);
       cmark_chunk_free(&title_chunk);
       goto match;
@@ -1157,8 +1797,9 @@ static cmark_node *handle_close_bracket(subject *subj) {
   }
 
   if (ref != NULL) { // found
-    url = cmark_strdup(subj->mem, ref->url);
-    title = cmark_strdup(subj->mem, ref->title);
+    subj->used_references = true;
+    url = cmark_strdup(subj->mem, ref->url, &url_len);
+    title = cmark_strdup(subj->mem, ref->title, &title_len);
     goto match;
   } else {
     goto noMatch;
@@ -1174,9 +1815,23 @@ match:
   inl = make_simple(subj->mem, is_image ? CMARK_NODE_IMAGE : CMARK_NODE_LINK);
   inl->as.link.url = url;
   inl->as.link.title = title;
+  inl->as.link.url_len = url_len;
+  inl->as.link.title_len = title_len;
+  if (subj->summary) {
+    if (!is_image) {
+      subj->summary->links++;
+    } else if (subj->summary->images++ == 0) {
+      char *first = (char *)subj->mem->realloc(NULL, url_len + 1);
+      memcpy(first, url ? (char *)url : "", url_len);
+      first[url_len] = 0;
+      subj->summary->first_image_url = first;
+    }
+  }
+#ifndef CMARK_LEAN_NODES
   inl->start_line = inl->end_line = subj->line;
   inl->start_column = opener->inl_text->start_column;
   inl->end_column = subj->pos + subj->column_offset + subj->block_offset;
+#endif
   cmark_node_insert_before(opener->inl_text, inl);
   // Add link text:
   tmp = opener->inl_text->next;
@@ -1192,6 +1847,9 @@ match:
 
   process_emphasis(subj, opener->position);
   pop_bracket(subj);
+  if (!is_image && subj->found_links) {
+    unlink_found_links(subj, inl);
+  }
 
   // Now, if we have a link, we also want to deactivate links until
   // we get a new opener. (This code can be removed if we decide to allow links
@@ -1226,43 +1884,12 @@ static cmark_node *handle_newline(subject *subj) {
   }
 }
 
-static bufsize_t subject_find_special_char(subject *subj, int options) {
-  // "\r\n\\`&_*[]<!"
-  // Mlem notes: added '~' and '^'
-  static const int8_t SPECIAL_CHARS[256] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
-      1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-  // " ' . -
-  static const char SMART_PUNCT_CHARS[] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  };
-
+static bufsize_t subject_find_special_char(subject *subj) {
+  const int8_t *special_chars = subj->special_chars;
   bufsize_t n = subj->pos + 1;
 
   while (n < subj->input.len) {
-    if (SPECIAL_CHARS[subj->input.data[n]])
-      return n;
-    if (options & CMARK_OPT_SMART && SMART_PUNCT_CHARS[subj->input.data[n]])
+    if (special_chars[subj->input.data[n]])
       return n;
     n++;
   }
@@ -1270,6 +1897,84 @@ static bufsize_t subject_find_special_char(subject *subj, int options) {
   return subj->input.len;
 }
 
+// Appends 'len' bytes to the literal of text node 'node', growing its
+// allocation geometrically. '*capacity' is the allocated size of the
+// literal, or 0 if unknown.
+static void text_append(cmark_mem *mem, cmark_node *node,
+                        bufsize_t *capacity, const unsigned char *data,
+                        bufsize_t len) {
+  bufsize_t needed = node->len + len + 1;
+
+  if (needed > *capacity) {
+    bufsize_t new_capacity = *capacity ? *capacity : node->len + 1;
+    if (new_capacity < 16) {
+      new_capacity = 16;
+    }
+    while (new_capacity < needed) {
+      new_capacity *= 2;
+    }
+    node->data = (unsigned char *)mem->realloc(node->data, new_capacity);
+    *capacity = new_capacity;
+  }
+  memcpy(node->data + node->len, data, len);
+  node->len += len;
+  node->data[node->len] = 0;
+}
+
+// Merges text into the current text run if that is still the last child
+// of 'parent'. Returns false if the text needs a node of its own.
+static bool extend_text_run(subject *subj, cmark_node *parent,
+                            const unsigned char *data, bufsize_t len,
+                            int end_column) {
+  cmark_node *run = subj->text_run;
+
+  if (run == NULL || parent->last_child != run) {
+    return false;
+  }
+  text_append(subj->mem, run, &subj->text_run_capacity, data, len);
+#ifdef CMARK_LEAN_NODES
+  (void)end_column;
+#else
+  run->end_column = end_column;
+#endif
+  return true;
+}
+
+// Text nodes referenced from the delimiter or bracket stack may still
+// change and must stay separate until emphasis is processed.
+static inline bool is_stacked(subject *subj, cmark_node *node) {
+  return (subj->last_delim && subj->last_delim->inl_text == node) ||
+         (subj->last_bracket && subj->last_bracket->inl_text == node);
+}
+
+// Merges text nodes that were left adjacent after resolving
+// delimiters and brackets, e.g. an unmatched '*' or '['.
+static void merge_adjacent_text(subject *subj, cmark_node *root) {
+  cmark_node *cur = root->first_child;
+
+  while (cur) {
+    if (cur->type == CMARK_NODE_TEXT) {
+      bufsize_t capacity = 0;
+      while (cur->next && cur->next->type == CMARK_NODE_TEXT) {
+        cmark_node *next = cur->next;
+        text_append(subj->mem, cur, &capacity, next->data, next->len);
+#ifndef CMARK_LEAN_NODES
+        cur->end_column = next->end_column;
+#endif
+        cmark_node_free(next);
+      }
+    }
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur->next == NULL && cur->parent != root) {
+      cur = cur->parent;
+    }
+    cur = cur->next;
+  }
+}
+
 // Parse an inline, advancing subject, and add it as a child of parent.
 // Return 0 if no inline can be parsed, 1 otherwise.
 static int parse_inline(subject *subj, cmark_node *parent, int options) {
@@ -1282,6 +1987,12 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
   if (c == 0) {
     return 0;
   }
+  // Markup counts as part of the word it's attached to.  Counting a
+  // character twice changes nothing, so text runs starting with it are
+  // counted in full below.
+  if (subj->summary && c != '`') {
+    cmark_summary_count_words(subj->summary, &subj->in_word, &c, 1);
+  }
   switch (c) {
   case '\r':
   case '\n':
@@ -1289,6 +2000,10 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
     break;
   case '`':
     new_inl = handle_backticks(subj, options);
+    if (subj->summary) {
+      cmark_summary_count_words(subj->summary, &subj->in_word, new_inl->data,
+                                new_inl->len);
+    }
     break;
   case '\\':
     new_inl = handle_backslash(subj);
@@ -1299,10 +2014,32 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
   case '<':
     new_inl = handle_pointy_brace(subj, options);
     break;
+  case '^':
+    new_inl = handle_script(subj, c, options);
+    if (new_inl == NULL) {
+      advance(subj);
+      new_inl = make_str(subj, subj->pos - 1, subj->pos - 1,
+                         cmark_chunk_literal("^"));
+      subj->merge_text = true;
+    }
+    break;
+  case '~':
+    // Runs of two or more are strikethrough, matched like emphasis.
+    if (subj->pos + 1 < subj->input.len &&
+        peek_at(subj, subj->pos + 1) == '~') {
+      new_inl = handle_delim(subj, c, false);
+      break;
+    }
+    new_inl = handle_script(subj, c, options);
+    if (new_inl == NULL) {
+      advance(subj);
+      new_inl = make_str(subj, subj->pos - 1, subj->pos - 1,
+                         cmark_chunk_literal("~"));
+      subj->merge_text = true;
+    }
+    break;
   case '*':
   case '_':
-  case '~': 
-  case '^':
   case '\'':
   case '"':
     new_inl = handle_delim(subj, c, (options & CMARK_OPT_SMART) != 0);
@@ -1322,6 +2059,10 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
     new_inl = handle_close_bracket(subj);
     break;
   case '!':
+    if ((options & CMARK_OPT_MENTIONS) &&
+        (new_inl = handle_mention(subj)) != NULL) {
+      break;
+    }
     advance(subj);
     if (peek_char(subj) == '[') {
       advance(subj);
@@ -1331,8 +2072,19 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
       new_inl = make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("!"));
     }
     break;
+  case '@':
+    if ((options & CMARK_OPT_MENTIONS) &&
+        (new_inl = handle_mention(subj)) != NULL) {
+      break;
+    }
+    // Not a mention: plain text.
+    // fall through
   default:
-    endpos = subject_find_special_char(subj, options);
+    endpos = subject_find_special_char(subj);
+    if ((options & CMARK_OPT_AUTOLINK_URLS) &&
+        (new_inl = handle_bare_url(subj, &endpos)) != NULL) {
+      break;
+    }
     contents = cmark_chunk_dup(&subj->input, subj->pos, endpos - subj->pos);
     startpos = subj->pos;
     subj->pos = endpos;
@@ -1341,25 +2093,73 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
     if (S_is_line_end_char(peek_char(subj))) {
       cmark_chunk_rtrim(&contents);
     }
+    if (subj->summary) {
+      cmark_summary_count_words(subj->summary, &subj->in_word, contents.data,
+                                contents.len);
+    }
 
+    if (extend_text_run(subj, parent, contents.data, contents.len,
+                        subj_column(subj, endpos - 1))) {
+      return 1;
+    }
     new_inl = make_str(subj, startpos, endpos - 1, contents);
   }
   if (new_inl != NULL) {
+    // A backslash before a line end makes a hard break.
+    if (new_inl->type == CMARK_NODE_LINEBREAK) {
+      subj->in_word = false;
+    }
+    if (new_inl->type == CMARK_NODE_TEXT && !is_stacked(subj, new_inl)) {
+      if (extend_text_run(subj, parent, new_inl->data, new_inl->len,
+                          node_end_column(new_inl))) {
+        // Not linked into the tree yet, so free it directly.
+        subj->mem->free(new_inl->data);
+        subj->mem->free(new_inl);
+        return 1;
+      }
+      subj->text_run = new_inl;
+      subj->text_run_capacity = 0;
+    }
     append_child(parent, new_inl);
   }
 
   return 1;
 }
 
+// Counts the words starting in 'data' that 'in_word' doesn't continue.
+void cmark_summary_count_words(cmark_document_summary *summary,
+                               bool *in_word, const unsigned char *data,
+                               bufsize_t len) {
+  bufsize_t i;
+
+  for (i = 0; i < len; i++) {
+    bool space = cmark_isspace(data[i]);
+    if (!space && !*in_word) {
+      summary->words++;
+    }
+    *in_word = !space;
+  }
+}
+
 // Parse inlines from parent's string_content, adding as children of parent.
 void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options) {
+                         cmark_reference_map *refmap, int options,
+                         cmark_inline_pool *pool,
+                         cmark_document_summary *summary) {
   int internal_offset = parent->type == CMARK_NODE_HEADING ?
     parent->as.heading.internal_offset : 0;
   subject subj;
+  cmark_inline_pool local_pool = CMARK_INLINE_POOL_INIT(mem);
   cmark_chunk content = {parent->data, parent->len};
-  subject_from_buf(mem, parent->start_line, parent->start_column - 1 + internal_offset, &subj, &content, refmap);
+#ifdef CMARK_LEAN_NODES
+  subject_from_buf(mem, 0, internal_offset, &subj, &content, refmap,
+                   pool ? pool : &local_pool, options);
+#else
+  subject_from_buf(mem, parent->start_line, parent->start_column - 1 + internal_offset, &subj, &content, refmap,
+                   pool ? pool : &local_pool, options);
+#endif
   cmark_chunk_rtrim(&subj.input);
+  subj.summary = summary;
 
   while (!is_eof(&subj) && parse_inline(&subj, parent, options))
     ;
@@ -1372,6 +2172,13 @@ void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
   while (subj.last_bracket) {
     pop_bracket(&subj);
   }
+  if (subj.merge_text) {
+    merge_adjacent_text(&subj, parent);
+  }
+  if (subj.used_references) {
+    parent->flags |= CMARK_NODE__REFERENCE_LINKS;
+  }
+  cmark_inline_pool_free(&local_pool);
 }
 
 // Parse zero or more space characters, including at most one newline.
@@ -1397,7 +2204,8 @@ bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
   bufsize_t matchlen = 0;
   bufsize_t beforetitle;
 
-  subject_from_buf(mem, -1, 0, &subj, input, NULL);
+  // Reference definitions never use the delimiter stacks.
+  subject_from_buf(mem, -1, 0, &subj, input, NULL, NULL, CMARK_OPT_DEFAULT);
 
   // parse label:
   if (!link_label(&subj, &lab) || lab.len == 0)
@@ -8,11 +8,42 @@
 extern "C" {
 #endif
 
-unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url);
-unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title);
+struct delimiter;
+struct bracket;
 
+// Storage for the delimiter and bracket stacks and the code span closer
+// index, grown on demand and reused across cmark_parse_inlines calls.
+typedef struct {
+  cmark_mem *mem;
+  struct delimiter *delimiters;
+  bufsize_t delimiters_capacity;
+  struct bracket *brackets;
+  bufsize_t brackets_capacity;
+  bufsize_t *backticks;
+  bufsize_t backticks_capacity;
+} cmark_inline_pool;
+
+#define CMARK_INLINE_POOL_INIT(m) {m, NULL, 0, NULL, 0, NULL, 0}
+
+void cmark_inline_pool_free(cmark_inline_pool *pool);
+
+unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url,
+                               bufsize_t *len);
+unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title,
+                                 bufsize_t *len);
+
+// 'pool' may be NULL, in which case temporary storage is used.  Words,
+// links and images are added to 'summary' unless it's NULL.
 void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options);
+                         cmark_reference_map *refmap, int options,
+                         cmark_inline_pool *pool,
+                         cmark_document_summary *summary);
+
+// Adds the words in 'data' to 'summary'.  'in_word' says whether a word
+// runs up to 'data', and is updated for what follows.
+void cmark_summary_count_words(cmark_document_summary *summary,
+                               bool *in_word, const unsigned char *data,
+                               bufsize_t len);
 
 bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
                                        cmark_reference_map *refmap);
@@ -27,8 +27,27 @@ cmark_iter *cmark_iter_new(cmark_node *root) {
   return iter;
 }
 
+cmark_iter *cmark_iter_new_filtered(cmark_node *root, uint32_t type_mask) {
+  cmark_iter *iter = cmark_iter_new(root);
+  if (iter) {
+    iter->type_mask = type_mask;
+  }
+  return iter;
+}
+
 void cmark_iter_free(cmark_iter *iter) { iter->mem->free(iter); }
 
+// Returns 'node' or the first of its following siblings that the
+// iterator should enter.
+static inline cmark_node *S_wanted(cmark_iter *iter, cmark_node *node) {
+  if (iter->type_mask) {
+    while (node && !cmark_node_find_types(node, iter->type_mask)) {
+      node = node->next;
+    }
+  }
+  return node;
+}
+
 static bool S_is_leaf(cmark_node *node) {
   return ((1 << node->type) & S_leaf_mask) != 0;
 }
@@ -36,6 +55,7 @@ static bool S_is_leaf(cmark_node *node) {
 cmark_event_type cmark_iter_next(cmark_iter *iter) {
   cmark_event_type ev_type = iter->next.ev_type;
   cmark_node *node = iter->next.node;
+  cmark_node *next;
 
   iter->cur.ev_type = ev_type;
   iter->cur.node = node;
@@ -46,20 +66,23 @@ cmark_event_type cmark_iter_next(cmark_iter *iter) {
 
   /* roll forward to next item, setting both fields */
   if (ev_type == CMARK_EVENT_ENTER && !S_is_leaf(node)) {
-    if (node->first_child == NULL) {
+    cmark_node *child;
+    cmark_node_ensure_inlines(node);
+    child = S_wanted(iter, node->first_child);
+    if (child == NULL) {
       /* stay on this node but exit */
       iter->next.ev_type = CMARK_EVENT_EXIT;
     } else {
       iter->next.ev_type = CMARK_EVENT_ENTER;
-      iter->next.node = node->first_child;
+      iter->next.node = child;
     }
   } else if (node == iter->root) {
     /* don't move past root */
     iter->next.ev_type = CMARK_EVENT_DONE;
     iter->next.node = NULL;
-  } else if (node->next) {
+  } else if ((next = S_wanted(iter, node->next)) != NULL) {
     iter->next.ev_type = CMARK_EVENT_ENTER;
-    iter->next.node = node->next;
+    iter->next.node = next;
   } else if (node->parent) {
     iter->next.ev_type = CMARK_EVENT_EXIT;
     iter->next.node = node->parent;
@@ -106,14 +129,21 @@ void cmark_consolidate_text_nodes(cmark_node *root) {
       while (tmp && tmp->type == CMARK_NODE_TEXT) {
         cmark_iter_next(iter); // advance pointer
         cmark_strbuf_put(&buf, tmp->data, tmp->len);
+#ifndef CMARK_LEAN_NODES
         cur->end_column = tmp->end_column;
+#endif
         next = tmp->next;
         cmark_node_free(tmp);
         tmp = next;
       }
-      iter->mem->free(cur->data);
+      if (cur->flags & CMARK_NODE__SHARED_STRINGS) {
+        cur->flags &= ~CMARK_NODE__SHARED_STRINGS;
+      } else {
+        iter->mem->free(cur->data);
+      }
       cur->len = buf.size;
       cur->data = cmark_strbuf_detach(&buf);
+      cmark_node_touch(cur);
     }
   }
 
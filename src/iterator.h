@@ -5,6 +5,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #include "cmark.h"
 
 typedef struct {
@@ -17,6 +19,8 @@ struct cmark_iter {
   cmark_node *root;
   cmark_iter_state cur;
   cmark_iter_state next;
+  // Types whose subtrees are visited, or 0 to visit everything.
+  uint32_t type_mask;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,265 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmark.h"
+#include "node.h"
+#include "utf8.h"
+
+// Styles and link in effect at some point of the walk.
+typedef struct {
+  uint32_t style;
+  int32_t link;
+} layout_state;
+
+typedef struct {
+  bool utf16;
+  // UTF-8 bytes or UTF-16 code units.
+  cmark_strbuf text;
+  // Array of cmark_text_run.
+  cmark_strbuf runs;
+  // NUL-terminated URLs, one after the other, and their offsets.
+  cmark_strbuf urls;
+  cmark_strbuf url_offsets;
+  size_t num_urls;
+} layout_builder;
+
+static inline size_t S_units(layout_builder *b) {
+  return b->utf16 ? (size_t)b->text.size / 2 : (size_t)b->text.size;
+}
+
+static inline void S_put_unit(cmark_strbuf *buf, uint16_t unit) {
+  cmark_strbuf_put(buf, (const unsigned char *)&unit, sizeof(unit));
+}
+
+static void S_put_utf16(cmark_strbuf *buf, const unsigned char *data,
+                        bufsize_t len) {
+  bufsize_t i = 0;
+
+  while (i < len) {
+    int32_t c;
+    int n;
+
+    if (data[i] < 0x80) {
+      S_put_unit(buf, data[i++]);
+      continue;
+    }
+    n = cmark_utf8proc_iterate(data + i, len - i, &c);
+    if (n < 0) {
+      c = 0xFFFD;
+      n = 1;
+    }
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      S_put_unit(buf, (uint16_t)(0xD800 + (c >> 10)));
+      S_put_unit(buf, (uint16_t)(0xDC00 + (c & 0x3FF)));
+    } else {
+      S_put_unit(buf, (uint16_t)c);
+    }
+    i += n;
+  }
+}
+
+// Appends text in the given state, extending the last run if it has the
+// same styles and link.
+static void S_put(layout_builder *b, const unsigned char *data, bufsize_t len,
+                  layout_state state) {
+  size_t start = S_units(b);
+  size_t end;
+  cmark_text_run run;
+
+  if (b->utf16) {
+    S_put_utf16(&b->text, data, len);
+  } else {
+    cmark_strbuf_put(&b->text, data, len);
+  }
+  end = S_units(b);
+  if (end == start) {
+    return;
+  }
+
+  if (b->runs.size) {
+    cmark_text_run *last =
+        (cmark_text_run *)(b->runs.ptr + b->runs.size) - 1;
+    if (last->style == state.style && last->link == state.link) {
+      last->length += (uint32_t)(end - start);
+      return;
+    }
+  }
+  run.start = (uint32_t)start;
+  run.length = (uint32_t)(end - start);
+  run.style = state.style;
+  run.link = state.link;
+  cmark_strbuf_put(&b->runs, (const unsigned char *)&run, sizeof(run));
+}
+
+static int32_t S_add_url(layout_builder *b, cmark_node *node) {
+  size_t len;
+  const char *url = cmark_node_get_url_n(node, &len);
+  bufsize_t offset = b->urls.size;
+
+  cmark_strbuf_put(&b->url_offsets, (const unsigned char *)&offset,
+                   sizeof(offset));
+  cmark_strbuf_put(&b->urls, (const unsigned char *)url, (bufsize_t)len);
+  cmark_strbuf_putc(&b->urls, 0);
+  return (int32_t)b->num_urls++;
+}
+
+static uint32_t S_style(cmark_node_type type) {
+  switch (type) {
+  case CMARK_NODE_EMPH:
+    return CMARK_STYLE_EMPH;
+  case CMARK_NODE_STRONG:
+    return CMARK_STYLE_STRONG;
+  case CMARK_NODE_SUPER:
+    return CMARK_STYLE_SUPER;
+  case CMARK_NODE_SUB:
+    return CMARK_STYLE_SUB;
+  case CMARK_NODE_STRIKE:
+    return CMARK_STYLE_STRIKE;
+  case CMARK_NODE_LINK:
+    return CMARK_STYLE_LINK;
+  case CMARK_NODE_IMAGE:
+    return CMARK_STYLE_IMAGE;
+  default:
+    return 0;
+  }
+}
+
+static void S_layout_inlines(layout_builder *b, cmark_node *node,
+                             cmark_mem *mem, int options) {
+  cmark_iter *iter = cmark_iter_new(node);
+  // States saved on entering styled inlines, restored on leaving them.
+  cmark_strbuf saved = CMARK_BUF_INIT(mem);
+  layout_state state = {0, -1};
+  cmark_event_type ev_type;
+
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    cmark_node *cur = cmark_iter_get_node(iter);
+
+    switch (cur->type) {
+    case CMARK_NODE_TEXT:
+      S_put(b, cur->data, cur->len, state);
+      break;
+    case CMARK_NODE_CODE: {
+      layout_state code = {state.style | CMARK_STYLE_CODE, state.link};
+      S_put(b, cur->data, cur->len, code);
+      break;
+    }
+    case CMARK_NODE_SOFTBREAK:
+      S_put(b,
+            (const unsigned char *)(options & CMARK_OPT_HARDBREAKS ? "\n"
+                                                                   : " "),
+            1, state);
+      break;
+    case CMARK_NODE_LINEBREAK:
+      S_put(b, (const unsigned char *)"\n", 1, state);
+      break;
+    case CMARK_NODE_EMPH:
+    case CMARK_NODE_STRONG:
+    case CMARK_NODE_SUPER:
+    case CMARK_NODE_SUB:
+    case CMARK_NODE_STRIKE:
+    case CMARK_NODE_LINK:
+    case CMARK_NODE_IMAGE:
+      if (ev_type == CMARK_EVENT_ENTER) {
+        cmark_strbuf_put(&saved, (const unsigned char *)&state,
+                         sizeof(state));
+        state.style |= S_style(cur->type);
+        if (cur->type == CMARK_NODE_LINK || cur->type == CMARK_NODE_IMAGE) {
+          state.link = S_add_url(b, cur);
+        }
+      } else {
+        saved.size -= sizeof(state);
+        memcpy(&state, saved.ptr + saved.size, sizeof(state));
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  cmark_strbuf_free(&saved);
+  cmark_iter_free(iter);
+}
+
+cmark_text_layout *cmark_render_layout(cmark_node *node, int options) {
+  cmark_mem *mem;
+  layout_builder b;
+  cmark_text_layout *layout;
+  unsigned char *p;
+  size_t unit, i;
+
+  if (node == NULL) {
+    return NULL;
+  }
+  switch (node->type) {
+  case CMARK_NODE_PARAGRAPH:
+  case CMARK_NODE_HEADING:
+  case CMARK_NODE_CODE_BLOCK:
+    break;
+  default:
+    return NULL;
+  }
+
+  mem = node->mem;
+  b.utf16 = (options & CMARK_OPT_LAYOUT_UTF16) != 0;
+  cmark_strbuf_init(mem, &b.text, 0);
+  cmark_strbuf_init(mem, &b.runs, 0);
+  cmark_strbuf_init(mem, &b.urls, 0);
+  cmark_strbuf_init(mem, &b.url_offsets, 0);
+  b.num_urls = 0;
+
+  if (node->type == CMARK_NODE_CODE_BLOCK) {
+    layout_state code = {CMARK_STYLE_CODE, -1};
+    bufsize_t len = node->len;
+    if (len > 0 && node->data[len - 1] == '\n') {
+      len--;
+    }
+    S_put(&b, node->data, len, code);
+  } else {
+    S_layout_inlines(&b, node, mem, options);
+  }
+
+  // The URL pointers need pointer alignment, which the header and runs
+  // keep; the text and URL strings follow them.
+  unit = b.utf16 ? 2 : 1;
+  layout = (cmark_text_layout *)mem->calloc(
+      1, sizeof(cmark_text_layout) + (size_t)b.runs.size +
+             b.num_urls * sizeof(char *) + (size_t)b.text.size + unit +
+             (size_t)b.urls.size);
+  p = (unsigned char *)(layout + 1);
+
+  layout->runs = (const cmark_text_run *)p;
+  layout->num_runs = (size_t)b.runs.size / sizeof(cmark_text_run);
+  if (b.runs.size) {
+    memcpy(p, b.runs.ptr, (size_t)b.runs.size);
+  }
+  p += b.runs.size;
+
+  layout->urls = (const char *const *)p;
+  layout->num_urls = b.num_urls;
+  p += b.num_urls * sizeof(char *);
+
+  layout->text = p;
+  layout->length = S_units(&b);
+  if (b.text.size) {
+    memcpy(p, b.text.ptr, (size_t)b.text.size);
+  }
+  p += b.text.size + unit;
+
+  if (b.urls.size) {
+    const char **urls = (const char **)layout->urls;
+    const bufsize_t *offsets = (const bufsize_t *)b.url_offsets.ptr;
+    memcpy(p, b.urls.ptr, (size_t)b.urls.size);
+    for (i = 0; i < b.num_urls; i++) {
+      urls[i] = (const char *)p + offsets[i];
+    }
+  }
+
+  cmark_strbuf_free(&b.text);
+  cmark_strbuf_free(&b.runs);
+  cmark_strbuf_free(&b.urls);
+  cmark_strbuf_free(&b.url_offsets);
+  return layout;
+}
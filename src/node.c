@@ -2,7 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "node.h"
+#include "references.h"
+#include "source.h"
 
 static void S_node_unlink(cmark_node *node);
 
@@ -79,6 +82,9 @@ cmark_node *cmark_node_new_with_mem(cmark_node_type type, cmark_mem *mem) {
   cmark_node *node = (cmark_node *)mem->calloc(1, sizeof(*node));
   node->mem = mem;
   node->type = (uint16_t)type;
+#ifndef CMARK_LEAN_NODES
+  node->type_mask = CMARK_NODE_MASK(type);
+#endif
 
   switch (node->type) {
   case CMARK_NODE_HEADING:
@@ -105,12 +111,137 @@ cmark_node *cmark_node_new(cmark_node_type type) {
   return cmark_node_new_with_mem(type, &DEFAULT_MEM_ALLOCATOR);
 }
 
+// Calls 'fn' on each string field of 'node' that is set for its type.
+static void S_each_string(cmark_node *node,
+                          void (*fn)(cmark_node *node, unsigned char **str,
+                                     bufsize_t len)) {
+  fn(node, &node->data, node->len);
+  switch (node->type) {
+  case CMARK_NODE_CODE_BLOCK:
+    fn(node, &node->as.code.info, node->as.code.info_len);
+    break;
+  case CMARK_NODE_SPOILER:
+    fn(node, &node->as.spoiler.title, node->as.spoiler.title_len);
+    break;
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    fn(node, &node->as.link.url, node->as.link.url_len);
+    fn(node, &node->as.link.title, node->as.link.title_len);
+    break;
+  case CMARK_NODE_CUSTOM_BLOCK:
+  case CMARK_NODE_CUSTOM_INLINE:
+    fn(node, &node->as.custom.on_enter,
+       node->as.custom.on_enter
+           ? (bufsize_t)strlen((char *)node->as.custom.on_enter)
+           : 0);
+    fn(node, &node->as.custom.on_exit,
+       node->as.custom.on_exit
+           ? (bufsize_t)strlen((char *)node->as.custom.on_exit)
+           : 0);
+    break;
+  default:
+    break;
+  }
+}
+
+static void S_forget_string(cmark_node *node, unsigned char **str,
+                            bufsize_t len) {
+  (void)node;
+  (void)len;
+  *str = NULL;
+}
+
+static void S_copy_string(cmark_node *node, unsigned char **str,
+                          bufsize_t len) {
+  unsigned char *copy;
+
+  if (*str == NULL) {
+    return;
+  }
+  copy = (unsigned char *)node->mem->realloc(NULL, len + 1);
+  memcpy(copy, *str, len);
+  copy[len] = 0;
+  *str = copy;
+}
+
+// Gives a clone its own copies of the strings it shares, before one of
+// them is replaced.
+static void S_unshare(cmark_node *node) {
+  if (node->flags & CMARK_NODE__SHARED_STRINGS) {
+    S_each_string(node, S_copy_string);
+    node->flags &=
+        ~(CMARK_NODE__SHARED_STRINGS | CMARK_NODE__DOCUMENT_URL);
+  }
+}
+
+// Lets go of a URL stored with the document, so that setting a new one
+// doesn't free it.
+static void S_release_url(cmark_node *node) {
+  if (node->flags & CMARK_NODE__DOCUMENT_URL) {
+    node->as.link.url = NULL;
+    node->flags &= ~CMARK_NODE__DOCUMENT_URL;
+  }
+}
+
+static void S_free_extra(cmark_mem *mem, cmark_document_extra *extra) {
+  unsigned char *block, *next;
+
+  if (extra == NULL) {
+    return;
+  }
+  for (block = extra->url_blocks; block; block = next) {
+    memcpy(&next, block, sizeof(next));
+    mem->free(block);
+  }
+  mem->free((char *)extra->summary.first_image_url);
+  cmark_line_index_free(extra->line_index);
+  mem->free(extra);
+}
+
+cmark_document_extra *cmark_document_extra_get(cmark_node *document) {
+  if (document->data == NULL) {
+    document->data = (unsigned char *)document->mem->calloc(
+        1, sizeof(cmark_document_extra));
+  }
+  return (cmark_document_extra *)document->data;
+}
+
+cmark_document_summary *cmark_document_reset_summary(cmark_node *document) {
+  cmark_document_extra *extra = cmark_document_extra_get(document);
+
+  document->mem->free((char *)extra->summary.first_image_url);
+  memset(&extra->summary, 0, sizeof(extra->summary));
+  extra->has_summary = true;
+  return &extra->summary;
+}
+
+const cmark_document_summary *cmark_document_get_summary(cmark_node *node) {
+  cmark_document_extra *extra;
+
+  if (node == NULL || node->type != CMARK_NODE_DOCUMENT) {
+    return NULL;
+  }
+  extra = (cmark_document_extra *)node->data;
+  return extra && extra->has_summary ? &extra->summary : NULL;
+}
+
 // Free a cmark_node list and any children.
-static void S_free_nodes(cmark_node *e) {
-  cmark_mem *mem = e->mem;
+static void S_free_nodes(cmark_mem *mem, cmark_node *e) {
   cmark_node *next;
   while (e != NULL) {
+    if (e->flags & CMARK_NODE__SHARED_STRINGS) {
+      S_each_string(e, S_forget_string);
+    } else if (e->flags & CMARK_NODE__DOCUMENT_URL) {
+      e->as.link.url = NULL;
+    }
     switch (e->type) {
+    case CMARK_NODE_DOCUMENT:
+      cmark_reference_map_free(e->as.document.refmap);
+      S_free_extra(mem, (cmark_document_extra *)e->data);
+#ifndef CMARK_LEAN_NODES
+      cmark_source_free(e->as.document.source);
+#endif
+      break;
     case CMARK_NODE_CODE_BLOCK:
       mem->free(e->data);
       mem->free(e->as.code.info);
@@ -122,6 +253,12 @@ static void S_free_nodes(cmark_node *e) {
     case CMARK_NODE_CODE:
       mem->free(e->data);
       break;
+    case CMARK_NODE_PARAGRAPH:
+    case CMARK_NODE_HEADING:
+      if (!(e->flags & CMARK_NODE__BORROWED_DATA)) {
+        mem->free(e->data);
+      }
+      break;
     case CMARK_NODE_LINK:
     case CMARK_NODE_IMAGE:
       mem->free(e->as.link.url);
@@ -147,9 +284,88 @@ static void S_free_nodes(cmark_node *e) {
 }
 
 void cmark_node_free(cmark_node *node) {
+  cmark_mem *mem = node->mem;
   S_node_unlink(node);
   node->next = NULL;
-  S_free_nodes(node);
+  S_free_nodes(mem, node);
+}
+
+// Copies a node without its links, sharing its strings with the original.
+static cmark_node *S_clone_node(cmark_mem *mem, cmark_node *node) {
+  cmark_node *copy = (cmark_node *)mem->calloc(1, sizeof(*copy));
+
+  *copy = *node;
+  copy->mem = mem;
+  copy->next = copy->prev = copy->parent = NULL;
+  copy->first_child = copy->last_child = NULL;
+  if (node->type == CMARK_NODE_DOCUMENT) {
+    // Inlines are parsed before cloning, so references aren't needed.
+    copy->as.document.refmap = NULL;
+    copy->data = NULL;
+#ifndef CMARK_LEAN_NODES
+    copy->as.document.source = NULL;
+#endif
+    if (cmark_document_get_summary(node)) {
+      const cmark_document_summary *summary = cmark_document_get_summary(node);
+      cmark_document_summary *copy_summary = cmark_document_reset_summary(copy);
+
+      *copy_summary = *summary;
+      if (summary->first_image_url) {
+        size_t len = strlen(summary->first_image_url);
+        char *url = (char *)mem->realloc(NULL, len + 1);
+        memcpy(url, summary->first_image_url, len + 1);
+        copy_summary->first_image_url = url;
+      }
+    }
+  } else {
+    copy->flags |= CMARK_NODE__SHARED_STRINGS;
+  }
+  return copy;
+}
+
+cmark_node *cmark_node_clone(cmark_node *node) {
+  cmark_node *src = node;
+  cmark_node *copy, *dst, *child;
+  cmark_mem *mem;
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  mem = node->mem;
+
+  cmark_node_ensure_inlines(node);
+  copy = dst = S_clone_node(mem, node);
+
+  // Pre-order walk, keeping 'dst' at the copy of 'src'.
+  for (;;) {
+    if (src->first_child) {
+      src = src->first_child;
+      cmark_node_ensure_inlines(src);
+      child = S_clone_node(mem, src);
+      child->parent = dst;
+      dst->first_child = dst->last_child = child;
+      dst = child;
+      continue;
+    }
+    while (src != node && src->next == NULL) {
+      src = src->parent;
+      dst = dst->parent;
+    }
+    if (src == node) {
+      break;
+    }
+    src = src->next;
+    cmark_node_ensure_inlines(src);
+    child = S_clone_node(mem, src);
+    child->parent = dst->parent;
+    child->prev = dst;
+    dst->next = child;
+    dst->parent->last_child = child;
+    dst = child;
+  }
+
+  return copy;
 }
 
 cmark_node_type cmark_node_get_type(cmark_node *node) {
@@ -245,6 +461,7 @@ cmark_node *cmark_node_first_child(cmark_node *node) {
   if (node == NULL) {
     return NULL;
   } else {
+    cmark_node_ensure_inlines(node);
     return node->first_child;
   }
 }
@@ -253,19 +470,19 @@ cmark_node *cmark_node_last_child(cmark_node *node) {
   if (node == NULL) {
     return NULL;
   } else {
+    cmark_node_ensure_inlines(node);
     return node->last_child;
   }
 }
 
-static bufsize_t cmark_set_cstr(cmark_mem *mem, unsigned char **dst,
-                                const char *src) {
+static bufsize_t cmark_set_str(cmark_mem *mem, unsigned char **dst,
+                               const char *src, bufsize_t len) {
   unsigned char *old = *dst;
-  bufsize_t len;
 
-  if (src && src[0]) {
-      len = (bufsize_t)strlen(src);
+  if (src && len > 0) {
       *dst = (unsigned char *)mem->realloc(NULL, len + 1);
-      memcpy(*dst, src, len + 1);
+      memcpy(*dst, src, len);
+      (*dst)[len] = 0;
   } else {
       len = 0;
       *dst = NULL;
@@ -277,20 +494,52 @@ static bufsize_t cmark_set_cstr(cmark_mem *mem, unsigned char **dst,
   return len;
 }
 
+static bufsize_t cmark_set_cstr(cmark_mem *mem, unsigned char **dst,
+                                const char *src) {
+  return cmark_set_str(mem, dst, src, src ? (bufsize_t)strlen(src) : 0);
+}
+
+// Length arguments of the _n setters must fit in a bufsize_t.
+static inline bool S_valid_len(size_t len) {
+  return len <= (size_t)(INT32_MAX / 2);
+}
+
+// Returns 'str', or an empty string if it's NULL, storing its length.
+static inline const char *S_str_n(unsigned char *str, bufsize_t str_len,
+                                  size_t *len) {
+  if (str == NULL) {
+    *len = 0;
+    return "";
+  }
+  *len = (size_t)str_len;
+  return (char *)str;
+}
+
 void *cmark_node_get_user_data(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return NULL;
+#else
   if (node == NULL) {
     return NULL;
   } else {
     return node->user_data;
   }
+#endif
 }
 
 int cmark_node_set_user_data(cmark_node *node, void *user_data) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  (void)user_data;
+  return 0;
+#else
   if (node == NULL) {
     return 0;
   }
   node->user_data = user_data;
   return 1;
+#endif
 }
 
 const char *cmark_node_get_literal(cmark_node *node) {
@@ -311,6 +560,24 @@ const char *cmark_node_get_literal(cmark_node *node) {
   return NULL;
 }
 
+const char *cmark_node_get_literal_n(cmark_node *node, size_t *len) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_CODE_BLOCK:
+    return S_str_n(node->data, node->len, len);
+
+  default:
+    break;
+  }
+
+  return NULL;
+}
+
 int cmark_node_set_literal(cmark_node *node, const char *content) {
   if (node == NULL) {
     return 0;
@@ -320,7 +587,32 @@ int cmark_node_set_literal(cmark_node *node, const char *content) {
   case CMARK_NODE_TEXT:
   case CMARK_NODE_CODE:
   case CMARK_NODE_CODE_BLOCK:
+    S_unshare(node);
     node->len = cmark_set_cstr(node->mem, &node->data, content);
+    cmark_node_touch(node);
+    return 1;
+
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+int cmark_node_set_literal_n(cmark_node *node, const char *content,
+                             size_t len) {
+  if (node == NULL || !S_valid_len(len)) {
+    return 0;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_CODE_BLOCK:
+    S_unshare(node);
+    node->len = cmark_set_str(node->mem, &node->data, content,
+                              (bufsize_t)len);
+    cmark_node_touch(node);
     return 1;
 
   default:
@@ -354,6 +646,7 @@ int cmark_node_set_heading_level(cmark_node *node, int level) {
   switch (node->type) {
   case CMARK_NODE_HEADING:
     node->as.heading.level = level;
+    cmark_node_touch(node);
     return 1;
 
   default:
@@ -386,6 +679,7 @@ int cmark_node_set_list_type(cmark_node *node, cmark_list_type type) {
 
   if (node->type == CMARK_NODE_LIST) {
     node->as.list.list_type = (unsigned char)type;
+    cmark_node_touch(node);
     return 1;
   } else {
     return 0;
@@ -415,6 +709,7 @@ int cmark_node_set_list_delim(cmark_node *node, cmark_delim_type delim) {
 
   if (node->type == CMARK_NODE_LIST) {
     node->as.list.delimiter = (unsigned char)delim;
+    cmark_node_touch(node);
     return 1;
   } else {
     return 0;
@@ -440,6 +735,7 @@ int cmark_node_set_list_start(cmark_node *node, int start) {
 
   if (node->type == CMARK_NODE_LIST) {
     node->as.list.start = start;
+    cmark_node_touch(node);
     return 1;
   } else {
     return 0;
@@ -465,6 +761,7 @@ int cmark_node_set_list_tight(cmark_node *node, int tight) {
 
   if (node->type == CMARK_NODE_LIST) {
     node->as.list.tight = tight == 1;
+    cmark_node_touch(node);
     return 1;
   } else {
     return 0;
@@ -483,13 +780,45 @@ const char *cmark_node_get_fence_info(cmark_node *node) {
   }
 }
 
+const char *cmark_node_get_fence_info_n(cmark_node *node, size_t *len) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  if (node->type == CMARK_NODE_CODE_BLOCK) {
+    return S_str_n(node->as.code.info, node->as.code.info_len, len);
+  } else {
+    return NULL;
+  }
+}
+
 int cmark_node_set_fence_info(cmark_node *node, const char *info) {
   if (node == NULL) {
     return 0;
   }
 
   if (node->type == CMARK_NODE_CODE_BLOCK) {
-    cmark_set_cstr(node->mem, &node->as.code.info, info);
+    S_unshare(node);
+    node->as.code.info_len =
+        cmark_set_cstr(node->mem, &node->as.code.info, info);
+    cmark_node_touch(node);
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+int cmark_node_set_fence_info_n(cmark_node *node, const char *info,
+                                size_t len) {
+  if (node == NULL || !S_valid_len(len)) {
+    return 0;
+  }
+
+  if (node->type == CMARK_NODE_CODE_BLOCK) {
+    S_unshare(node);
+    node->as.code.info_len = cmark_set_str(node->mem, &node->as.code.info,
+                                           info, (bufsize_t)len);
+    cmark_node_touch(node);
     return 1;
   } else {
     return 0;
@@ -512,6 +841,22 @@ const char *cmark_node_get_url(cmark_node *node) {
   return NULL;
 }
 
+const char *cmark_node_get_url_n(cmark_node *node, size_t *len) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    return S_str_n(node->as.link.url, node->as.link.url_len, len);
+  default:
+    break;
+  }
+
+  return NULL;
+}
+
 int cmark_node_set_url(cmark_node *node, const char *url) {
   if (node == NULL) {
     return 0;
@@ -520,7 +865,34 @@ int cmark_node_set_url(cmark_node *node, const char *url) {
   switch (node->type) {
   case CMARK_NODE_LINK:
   case CMARK_NODE_IMAGE:
-    cmark_set_cstr(node->mem, &node->as.link.url, url);
+    S_unshare(node);
+    S_release_url(node);
+    node->flags &= ~CMARK_NODE__MENTION;
+    node->as.link.url_len =
+        cmark_set_cstr(node->mem, &node->as.link.url, url);
+    cmark_node_touch(node);
+    return 1;
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+int cmark_node_set_url_n(cmark_node *node, const char *url, size_t len) {
+  if (node == NULL || !S_valid_len(len)) {
+    return 0;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    S_unshare(node);
+    S_release_url(node);
+    node->flags &= ~CMARK_NODE__MENTION;
+    node->as.link.url_len = cmark_set_str(node->mem, &node->as.link.url,
+                                          url, (bufsize_t)len);
+    cmark_node_touch(node);
     return 1;
   default:
     break;
@@ -529,6 +901,145 @@ int cmark_node_set_url(cmark_node *node, const char *url) {
   return 0;
 }
 
+cmark_mention_type cmark_node_get_mention(cmark_node *node, const char **name,
+                                          size_t *name_len,
+                                          const char **instance,
+                                          size_t *instance_len) {
+  const char *start, *at;
+
+  if (node == NULL || node->type != CMARK_NODE_LINK ||
+      !(node->flags & CMARK_NODE__MENTION)) {
+    return CMARK_NO_MENTION;
+  }
+
+  // The URL is "/u/name@instance" or "/c/name@instance".
+  start = (const char *)node->as.link.url + 3;
+  at = strchr(start, '@');
+  if (name) {
+    *name = start;
+  }
+  if (name_len) {
+    *name_len = (size_t)(at - start);
+  }
+  if (instance) {
+    *instance = at + 1;
+  }
+  if (instance_len) {
+    *instance_len = strlen(at + 1);
+  }
+  return (node->flags & CMARK_NODE__USER_MENTION) ? CMARK_USER_MENTION
+                                                  : CMARK_COMMUNITY_MENTION;
+}
+
+typedef struct {
+  cmark_node *node;
+  bufsize_t offset;
+  bufsize_t len;
+} url_edit;
+
+int cmark_node_rewrite_urls(cmark_node *root, cmark_url_rewriter rewriter,
+                            void *data) {
+  cmark_node *document = root;
+  cmark_mem *mem;
+  cmark_strbuf buf;
+  cmark_iter *iter;
+  cmark_event_type ev_type;
+  url_edit *edits = NULL;
+  size_t num_edits = 0, capacity = 0, i;
+  unsigned char *block;
+  int count = 0;
+
+  if (root == NULL || rewriter == NULL) {
+    return 0;
+  }
+  while (document->parent) {
+    document = document->parent;
+  }
+  if (document->type != CMARK_NODE_DOCUMENT) {
+    document = NULL;
+  }
+  mem = (document ? document : root)->mem;
+  cmark_strbuf_init(mem, &buf, 0);
+
+  iter = cmark_iter_new_filtered(root, CMARK_NODE_MASK(CMARK_NODE_LINK) |
+                                           CMARK_NODE_MASK(CMARK_NODE_IMAGE));
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    cmark_node *node = cmark_iter_get_node(iter);
+    const char *url;
+    size_t len;
+
+    if (ev_type != CMARK_EVENT_ENTER ||
+        (node->type != CMARK_NODE_LINK && node->type != CMARK_NODE_IMAGE)) {
+      continue;
+    }
+    url = rewriter(node, node->as.link.url ? (char *)node->as.link.url : "",
+                   data);
+    if (url == NULL) {
+      continue;
+    }
+    len = strlen(url);
+    if (!S_valid_len(len) ||
+        ((bufsize_t)len == node->as.link.url_len &&
+         (len == 0 || memcmp(url, node->as.link.url, len) == 0))) {
+      continue;
+    }
+    count++;
+
+    // Outside a document, there's no storage that lives as long as the
+    // tree.
+    if (document == NULL) {
+      cmark_node_set_url_n(node, url, len);
+      continue;
+    }
+    if (num_edits == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      edits = (url_edit *)mem->realloc(edits, capacity * sizeof(url_edit));
+    }
+    if (buf.size == 0) {
+      // Room for the link to the next block.
+      block = NULL;
+      cmark_strbuf_put(&buf, (unsigned char *)&block, sizeof(block));
+    }
+    edits[num_edits].node = node;
+    edits[num_edits].offset = buf.size;
+    edits[num_edits].len = (bufsize_t)len;
+    num_edits++;
+    cmark_strbuf_put(&buf, (const unsigned char *)url, (bufsize_t)len);
+    cmark_strbuf_putc(&buf, 0);
+  }
+  cmark_iter_free(iter);
+
+  // The new URLs are stored with the document in a single block, and
+  // only installed once the walk is over, as the buffer moves while it
+  // grows.
+  if (num_edits) {
+    cmark_document_extra *extra = cmark_document_extra_get(document);
+
+    block = cmark_strbuf_detach(&buf);
+    memcpy(block, &extra->url_blocks, sizeof(extra->url_blocks));
+    extra->url_blocks = block;
+
+    for (i = 0; i < num_edits; i++) {
+      cmark_node *node = edits[i].node;
+
+      if (!(node->flags &
+            (CMARK_NODE__SHARED_STRINGS | CMARK_NODE__DOCUMENT_URL))) {
+        node->mem->free(node->as.link.url);
+      }
+      node->as.link.url = block + edits[i].offset;
+      node->as.link.url_len = edits[i].len;
+      node->flags =
+          (uint16_t)((node->flags & ~CMARK_NODE__MENTION) |
+                     CMARK_NODE__DOCUMENT_URL);
+      cmark_node_touch(node);
+    }
+  }
+
+  cmark_strbuf_free(&buf);
+  mem->free(edits);
+  return count;
+}
+
 const char *cmark_node_get_title(cmark_node *node) {
   if (node == NULL) {
     return NULL;
@@ -547,6 +1058,24 @@ const char *cmark_node_get_title(cmark_node *node) {
   return NULL;
 }
 
+const char *cmark_node_get_title_n(cmark_node *node, size_t *len) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    return S_str_n(node->as.link.title, node->as.link.title_len, len);
+  case CMARK_NODE_SPOILER:
+    return S_str_n(node->as.spoiler.title, node->as.spoiler.title_len, len);
+  default:
+    break;
+  }
+
+  return NULL;
+}
+
 int cmark_node_set_title(cmark_node *node, const char *title) {
   if (node == NULL) {
     return 0;
@@ -555,7 +1084,30 @@ int cmark_node_set_title(cmark_node *node, const char *title) {
   switch (node->type) {
   case CMARK_NODE_LINK:
   case CMARK_NODE_IMAGE:
-    cmark_set_cstr(node->mem, &node->as.link.title, title);
+    S_unshare(node);
+    node->as.link.title_len =
+        cmark_set_cstr(node->mem, &node->as.link.title, title);
+    cmark_node_touch(node);
+    return 1;
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+int cmark_node_set_title_n(cmark_node *node, const char *title, size_t len) {
+  if (node == NULL || !S_valid_len(len)) {
+    return 0;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    S_unshare(node);
+    node->as.link.title_len = cmark_set_str(
+        node->mem, &node->as.link.title, title, (bufsize_t)len);
+    cmark_node_touch(node);
     return 1;
   default:
     break;
@@ -588,7 +1140,9 @@ int cmark_node_set_on_enter(cmark_node *node, const char *on_enter) {
   switch (node->type) {
   case CMARK_NODE_CUSTOM_INLINE:
   case CMARK_NODE_CUSTOM_BLOCK:
+    S_unshare(node);
     cmark_set_cstr(node->mem, &node->as.custom.on_enter, on_enter);
+    cmark_node_touch(node);
     return 1;
   default:
     break;
@@ -621,7 +1175,9 @@ int cmark_node_set_on_exit(cmark_node *node, const char *on_exit) {
   switch (node->type) {
   case CMARK_NODE_CUSTOM_INLINE:
   case CMARK_NODE_CUSTOM_BLOCK:
+    S_unshare(node);
     cmark_set_cstr(node->mem, &node->as.custom.on_exit, on_exit);
+    cmark_node_touch(node);
     return 1;
   default:
     break;
@@ -631,33 +1187,294 @@ int cmark_node_set_on_exit(cmark_node *node, const char *on_exit) {
 }
 
 int cmark_node_get_start_line(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return 0;
+#else
   if (node == NULL) {
     return 0;
   }
   return node->start_line;
+#endif
 }
 
 int cmark_node_get_start_column(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return 0;
+#else
   if (node == NULL) {
     return 0;
   }
   return node->start_column;
+#endif
 }
 
 int cmark_node_get_end_line(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return 0;
+#else
   if (node == NULL) {
     return 0;
   }
   return node->end_line;
+#endif
 }
 
 int cmark_node_get_end_column(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+  return 0;
+#else
   if (node == NULL) {
     return 0;
   }
   return node->end_column;
+#endif
+}
+
+// Returns the line index of 'document', if it has one.
+static cmark_line_index *S_line_index(cmark_node *document) {
+  cmark_document_extra *extra;
+
+  if (document == NULL || document->type != CMARK_NODE_DOCUMENT) {
+    return NULL;
+  }
+  extra = (cmark_document_extra *)document->data;
+  return extra ? extra->line_index : NULL;
+}
+
+int cmark_document_get_byte_offset(cmark_node *document, int line,
+                                   int column, size_t *offset) {
+  return cmark_line_index_get_byte_offset(S_line_index(document), line,
+                                          column, offset);
+}
+
+int cmark_document_get_utf16_offset(cmark_node *document, int line,
+                                    int column, size_t *offset) {
+  return cmark_line_index_get_utf16_offset(S_line_index(document), line,
+                                           column, offset);
+}
+
+int cmark_node_get_truncated(cmark_node *node) {
+  if (node == NULL || node->type != CMARK_NODE_DOCUMENT) {
+    return 0;
+  }
+  return (node->flags & CMARK_NODE__TRUNCATED) != 0;
+}
+
+static inline uint64_t S_hash_str(uint64_t h, const unsigned char *str,
+                                  bufsize_t len) {
+  return cmark_hash_combine(h, str ? cmark_hash_bytes(str, (size_t)len, 0)
+                                   : 0);
+}
+
+// Hashes a node's own content, leaving out source positions.
+uint64_t cmark_node_own_hash(cmark_node *node) {
+  uint64_t h = cmark_hash_combine(0, node->type);
+
+  switch (node->type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+    h = S_hash_str(h, node->data, node->len);
+    break;
+  case CMARK_NODE_CODE_BLOCK:
+    h = S_hash_str(h, node->data, node->len);
+    h = S_hash_str(h, node->as.code.info, node->as.code.info_len);
+    h = cmark_hash_combine(h, (uint64_t)node->as.code.fenced);
+    break;
+  case CMARK_NODE_SPOILER:
+    h = S_hash_str(h, node->as.spoiler.title, node->as.spoiler.title_len);
+    break;
+  case CMARK_NODE_HEADING:
+    h = cmark_hash_combine(h, (uint64_t)node->as.heading.level);
+    break;
+  case CMARK_NODE_LIST:
+    h = cmark_hash_combine(h, node->as.list.list_type);
+    h = cmark_hash_combine(h, node->as.list.delimiter);
+    h = cmark_hash_combine(h, node->as.list.bullet_char);
+    h = cmark_hash_combine(h, (uint64_t)node->as.list.start);
+    h = cmark_hash_combine(h, node->as.list.tight);
+    break;
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    h = S_hash_str(h, node->as.link.url, node->as.link.url_len);
+    h = S_hash_str(h, node->as.link.title, node->as.link.title_len);
+    h = cmark_hash_combine(h, node->flags & CMARK_NODE__MENTION);
+    break;
+  case CMARK_NODE_CUSTOM_BLOCK:
+  case CMARK_NODE_CUSTOM_INLINE:
+    h = S_hash_str(h, node->as.custom.on_enter,
+                   node->as.custom.on_enter
+                       ? (bufsize_t)strlen((char *)node->as.custom.on_enter)
+                       : 0);
+    h = S_hash_str(h, node->as.custom.on_exit,
+                   node->as.custom.on_exit
+                       ? (bufsize_t)strlen((char *)node->as.custom.on_exit)
+                       : 0);
+    break;
+  default:
+    break;
+  }
+
+  return h;
 }
 
+#ifdef CMARK_LEAN_NODES
+// Lean nodes don't cache hashes, so the subtree is hashed from scratch,
+// keeping the running hashes of the nodes being walked on a stack.
+uint64_t cmark_node_get_hash(cmark_node *node) {
+  cmark_node *cur = node;
+  uint64_t *stack, h;
+  size_t depth = 0, capacity = 16;
+
+  if (node == NULL) {
+    return 0;
+  }
+
+  stack = (uint64_t *)node->mem->realloc(NULL, capacity * sizeof(uint64_t));
+  for (;;) {
+    cmark_node_ensure_inlines(cur);
+    if (depth == capacity) {
+      capacity *= 2;
+      stack = (uint64_t *)node->mem->realloc(stack,
+                                             capacity * sizeof(uint64_t));
+    }
+    stack[depth++] = cmark_node_own_hash(cur);
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    // Finish 'cur' and the ancestors it was the last child of.
+    for (;;) {
+      h = cmark_hash_mix(stack[--depth]);
+      if (cur == node) {
+        node->mem->free(stack);
+        return h;
+      }
+      stack[depth - 1] = cmark_hash_combine(stack[depth - 1], h);
+      if (cur->next) {
+        cur = cur->next;
+        break;
+      }
+      cur = cur->parent;
+    }
+  }
+}
+#else
+// Combines a node's own hash with those of its children, which must be
+// valid.
+static void S_update_hash(cmark_node *node) {
+  uint64_t h = cmark_node_own_hash(node);
+  cmark_node *child;
+
+  for (child = node->first_child; child; child = child->next) {
+    h = cmark_hash_combine(h, child->hash);
+  }
+  node->hash = cmark_hash_mix(h);
+  node->flags |= CMARK_NODE__HASH_VALID;
+}
+
+uint64_t cmark_node_get_hash(cmark_node *node) {
+  cmark_node *cur = node;
+
+  if (node == NULL) {
+    return 0;
+  }
+
+  // Post-order walk over the subtrees without a valid hash.
+  for (;;) {
+    if (!(cur->flags & CMARK_NODE__HASH_VALID)) {
+      cmark_node_ensure_inlines(cur);
+      if (cur->first_child) {
+        cur = cur->first_child;
+        continue;
+      }
+      S_update_hash(cur);
+    }
+    while (cur != node && cur->next == NULL) {
+      cur = cur->parent;
+      S_update_hash(cur);
+    }
+    if (cur == node) {
+      break;
+    }
+    cur = cur->next;
+  }
+
+  return node->hash;
+}
+#endif
+
+static const uint32_t S_inline_types =
+    ((uint32_t)2 << CMARK_NODE_LAST_INLINE) -
+    ((uint32_t)1 << CMARK_NODE_FIRST_INLINE);
+
+#ifdef CMARK_LEAN_NODES
+uint32_t cmark_node_find_types(cmark_node *root, uint32_t wanted) {
+  cmark_node *cur = root;
+  uint32_t found = 0;
+
+  for (;;) {
+    found |= CMARK_NODE_MASK(cur->type);
+    if (cur->flags & CMARK_NODE__INLINES_PENDING) {
+      found |= S_inline_types;
+    }
+    if ((found & wanted) == wanted) {
+      break;
+    }
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != root && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    if (cur == root) {
+      break;
+    }
+    cur = cur->next;
+  }
+
+  return found & wanted;
+}
+#else
+static void S_update_type_mask(cmark_node *node) {
+  uint32_t mask = CMARK_NODE_MASK(node->type);
+  cmark_node *child;
+
+  if (node->flags & CMARK_NODE__INLINES_PENDING) {
+    mask |= S_inline_types;
+  }
+  for (child = node->first_child; child; child = child->next) {
+    mask |= child->type_mask;
+  }
+  node->type_mask = mask;
+}
+
+void cmark_node_update_type_masks(cmark_node *root) {
+  cmark_node *cur = root;
+
+  // Post-order walk, so children are done before their parent.
+  for (;;) {
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    S_update_type_mask(cur);
+    while (cur != root && cur->next == NULL) {
+      cur = cur->parent;
+      S_update_type_mask(cur);
+    }
+    if (cur == root) {
+      break;
+    }
+    cur = cur->next;
+  }
+}
+#endif
+
 // Unlink a node without adjusting its next, prev, and parent pointers.
 static void S_node_unlink(cmark_node *node) {
   if (node == NULL) {
@@ -680,10 +1497,34 @@ static void S_node_unlink(cmark_node *node) {
     if (parent->last_child == node) {
       parent->last_child = node->prev;
     }
+    cmark_node_touch(parent);
+  }
+}
+
+// A block moved out of its document loses access to the document's
+// reference map, so any inlines still pending below it are parsed first.
+static void S_parse_pending_subtree(cmark_node *node) {
+  cmark_node *cur = node;
+
+  if (node->parent == NULL || !S_is_block(node)) {
+    return;
+  }
+
+  while (cur) {
+    cmark_node_ensure_inlines(cur);
+    if (cur->first_child && S_is_block(cur->first_child)) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != node && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == node ? NULL : cur->next;
   }
 }
 
 void cmark_node_unlink(cmark_node *node) {
+  S_parse_pending_subtree(node);
   S_node_unlink(node);
 
   node->next = NULL;
@@ -700,6 +1541,7 @@ int cmark_node_insert_before(cmark_node *node, cmark_node *sibling) {
     return 0;
   }
 
+  S_parse_pending_subtree(sibling);
   S_node_unlink(sibling);
 
   cmark_node *old_prev = node->prev;
@@ -720,6 +1562,8 @@ int cmark_node_insert_before(cmark_node *node, cmark_node *sibling) {
   if (parent && !old_prev) {
     parent->first_child = sibling;
   }
+  cmark_node_touch(parent);
+  cmark_node_add_types(parent, sibling->type_mask);
 
   return 1;
 }
@@ -733,6 +1577,7 @@ int cmark_node_insert_after(cmark_node *node, cmark_node *sibling) {
     return 0;
   }
 
+  S_parse_pending_subtree(sibling);
   S_node_unlink(sibling);
 
   cmark_node *old_next = node->next;
@@ -753,6 +1598,8 @@ int cmark_node_insert_after(cmark_node *node, cmark_node *sibling) {
   if (parent && !old_next) {
     parent->last_child = sibling;
   }
+  cmark_node_touch(parent);
+  cmark_node_add_types(parent, sibling->type_mask);
 
   return 1;
 }
@@ -770,6 +1617,8 @@ int cmark_node_prepend_child(cmark_node *node, cmark_node *child) {
     return 0;
   }
 
+  cmark_node_ensure_inlines(node);
+  S_parse_pending_subtree(child);
   S_node_unlink(child);
 
   cmark_node *old_first_child = node->first_child;
@@ -785,6 +1634,8 @@ int cmark_node_prepend_child(cmark_node *node, cmark_node *child) {
     // Also set last_child if node previously had no children.
     node->last_child = child;
   }
+  cmark_node_touch(node);
+  cmark_node_add_types(node, child->type_mask);
 
   return 1;
 }
@@ -794,6 +1645,8 @@ int cmark_node_append_child(cmark_node *node, cmark_node *child) {
     return 0;
   }
 
+  cmark_node_ensure_inlines(node);
+  S_parse_pending_subtree(child);
   S_node_unlink(child);
 
   cmark_node *old_last_child = node->last_child;
@@ -809,6 +1662,8 @@ int cmark_node_append_child(cmark_node *node, cmark_node *child) {
     // Also set first_child if node previously had no children.
     node->first_child = child;
   }
+  cmark_node_touch(node);
+  cmark_node_add_types(node, child->type_mask);
 
   return 1;
 }
@@ -818,8 +1673,8 @@ static void S_print_error(FILE *out, cmark_node *node, const char *elem) {
     return;
   }
   fprintf(out, "Invalid '%s' in node type %s at %d:%d\n", elem,
-          cmark_node_get_type_string(node), node->start_line,
-          node->start_column);
+          cmark_node_get_type_string(node), cmark_node_get_start_line(node),
+          cmark_node_get_start_column(node));
 }
 
 int cmark_node_check(cmark_node *node, FILE *out) {
@@ -24,6 +24,7 @@ typedef struct {
 
 typedef struct {
   unsigned char *info;
+  bufsize_t info_len;
   uint8_t fence_length;
   uint8_t fence_offset;
   unsigned char fence_char;
@@ -32,6 +33,7 @@ typedef struct {
 
 typedef struct {
   unsigned char *title;
+  bufsize_t title_len;
   uint8_t fence_length;
   uint8_t fence_offset;
 } cmark_spoiler;
@@ -45,6 +47,8 @@ typedef struct {
 typedef struct {
   unsigned char *url;
   unsigned char *title;
+  bufsize_t url_len;
+  bufsize_t title_len;
 } cmark_link;
 
 typedef struct {
@@ -52,13 +56,62 @@ typedef struct {
   unsigned char *on_exit;
 } cmark_custom;
 
+typedef struct {
+  // Kept alive for blocks whose inlines are parsed on first access.
+  struct cmark_reference_map *refmap;
+  int options;
+#ifndef CMARK_LEAN_NODES
+  // Input kept by CMARK_OPT_RETAIN_SOURCE.
+  struct cmark_source *source;
+#endif
+} cmark_document;
+
+// State kept by few documents, hung off the document's data field, which
+// documents don't use for a literal.  Allocated on first use.
+typedef struct {
+  // Blocks of URLs written by cmark_node_rewrite_urls, each starting with
+  // a pointer to the next.
+  unsigned char *url_blocks;
+  // Set by CMARK_OPT_DOCUMENT_SUMMARY.  first_image_url is owned here.
+  cmark_document_summary summary;
+  bool has_summary;
+  // Set by CMARK_OPT_SOURCE_OFFSETS.
+  struct cmark_line_index *line_index;
+} cmark_document_extra;
+
 enum cmark_node__internal_flags {
   CMARK_NODE__OPEN = (1 << 0),
   CMARK_NODE__LAST_LINE_BLANK = (1 << 1),
   CMARK_NODE__LAST_LINE_CHECKED = (1 << 2),
   CMARK_NODE__LIST_LAST_LINE_BLANK = (1 << 3),
+  CMARK_NODE__TRUNCATED = (1 << 4),
+  CMARK_NODE__INLINES_PENDING = (1 << 5),
+  CMARK_NODE__HASH_VALID = (1 << 6),
+  // Set on leaf blocks with links resolved through reference definitions.
+  CMARK_NODE__REFERENCE_LINKS = (1 << 7),
+  // The node's literal, URL, title and other strings belong to the node
+  // it was cloned from.
+  CMARK_NODE__SHARED_STRINGS = (1 << 8),
+  // The link's URL was written by cmark_node_rewrite_urls and belongs to
+  // the document.
+  CMARK_NODE__DOCUMENT_URL = (1 << 9),
+  // The link is a mention parsed with CMARK_OPT_MENTIONS.
+  CMARK_NODE__USER_MENTION = (1 << 10),
+  CMARK_NODE__COMMUNITY_MENTION = (1 << 11),
+  CMARK_NODE__MENTION =
+      CMARK_NODE__USER_MENTION | CMARK_NODE__COMMUNITY_MENTION,
+  // The leaf block's content points into the parser's copy of the input
+  // until its inlines are parsed.
+  CMARK_NODE__BORROWED_DATA = (1 << 12),
+  // The link is a bare URL found by CMARK_OPT_AUTOLINK_URLS.
+  CMARK_NODE__BARE_URL = (1 << 13),
+  // The fenced code block or spoiler was ended by a closing fence rather
+  // than by the end of its container.
+  CMARK_NODE__FENCE_CLOSED = (1 << 14),
 };
 
+// Lean builds (CMARK_LEAN_NODES) drop the user data, source positions,
+// type mask and cached hash.
 struct cmark_node {
   cmark_mem *mem;
 
@@ -68,18 +121,32 @@ struct cmark_node {
   struct cmark_node *first_child;
   struct cmark_node *last_child;
 
+#ifndef CMARK_LEAN_NODES
   void *user_data;
+#endif
 
   unsigned char *data;
   bufsize_t len;
 
+#ifndef CMARK_LEAN_NODES
   int start_line;
   int start_column;
   int end_line;
   int end_column;
+#endif
   uint16_t type;
   uint16_t flags;
 
+#ifndef CMARK_LEAN_NODES
+  // CMARK_NODE_MASK bits of the types in the subtree, the node's own
+  // included.  Unlinking leaves them alone, so they may list types that
+  // are gone.
+  uint32_t type_mask;
+
+  // Structural hash of the subtree, if CMARK_NODE__HASH_VALID is set.
+  uint64_t hash;
+#endif
+
   union {
     cmark_list list;
     cmark_code code;
@@ -87,12 +154,82 @@ struct cmark_node {
     cmark_heading heading;
     cmark_link link;
     cmark_custom custom;
+    cmark_document document;
     int html_block_type;
   } as;
 };
 
 CMARK_EXPORT int cmark_node_check(cmark_node *node, FILE *out);
 
+// Parses the raw content of a paragraph or heading whose inline parsing
+// was deferred by CMARK_OPT_LAZY_INLINES.
+void cmark_node_parse_pending_inlines(cmark_node *node);
+
+static inline void cmark_node_ensure_inlines(cmark_node *node) {
+  if (node->flags & CMARK_NODE__INLINES_PENDING) {
+    cmark_node_parse_pending_inlines(node);
+  }
+}
+
+// Records the types of a subtree added under 'node' in the type masks of
+// 'node' and its ancestors.  An ancestor's mask covers its descendants',
+// so the walk stops at the first one that already has them.
+// Lean builds keep no type masks, and don't evaluate 'mask'.
+#ifdef CMARK_LEAN_NODES
+#define cmark_node_add_types(node, mask) ((void)(node))
+#else
+static inline void cmark_node_add_types(cmark_node *node, uint32_t mask) {
+  while (node && (node->type_mask & mask) != mask) {
+    node->type_mask |= mask;
+    node = node->parent;
+  }
+}
+#endif
+
+// Recomputes the type masks of the subtree rooted at 'root' from scratch.
+// Blocks with deferred inlines are assumed to hold every inline type.
+#ifdef CMARK_LEAN_NODES
+#define cmark_node_update_type_masks(root) ((void)(root))
+#else
+void cmark_node_update_type_masks(cmark_node *root);
+#endif
+
+// Returns the bits of 'wanted' standing for types found in the subtree
+// rooted at 'root', with the same caveats as the type masks.  Lean builds
+// walk the subtree, stopping once every wanted type has turned up.
+#ifdef CMARK_LEAN_NODES
+uint32_t cmark_node_find_types(cmark_node *root, uint32_t wanted);
+#else
+static inline uint32_t cmark_node_find_types(cmark_node *root,
+                                             uint32_t wanted) {
+  return root->type_mask & wanted;
+}
+#endif
+
+// Returns the extra state of 'document', allocating it if needed.
+cmark_document_extra *cmark_document_extra_get(cmark_node *document);
+
+// Clears the summary of 'document' for a new parse and returns it.
+cmark_document_summary *cmark_document_reset_summary(cmark_node *document);
+
+// Hashes a node's own content, leaving out its children and source
+// positions.
+uint64_t cmark_node_own_hash(cmark_node *node);
+
+// Records that 'node' changed, dropping the cached hashes of it and its
+// ancestors.  A node's hash is only valid while its children's are, so
+// the walk stops at the first node without one.
+static inline void cmark_node_touch(cmark_node *node) {
+#ifdef CMARK_LEAN_NODES
+  (void)node;
+#else
+  while (node && (node->flags & CMARK_NODE__HASH_VALID)) {
+    node->flags &= ~CMARK_NODE__HASH_VALID;
+    node = node->parent;
+  }
+#endif
+}
+
 #ifdef __cplusplus
 }
 #endif
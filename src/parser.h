@@ -5,6 +5,7 @@
 #include "references.h"
 #include "node.h"
 #include "buffer.h"
+#include "chunk.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,13 +27,44 @@ struct cmark_parser {
   int indent;
   bool blank;
   bool partially_consumed_tab;
+  // List item opened on the current line, if any.
+  struct cmark_node *new_item;
   cmark_strbuf curline;
+  // The line being processed: the contents of curline, or a line of
+  // 'input' parsed in place.
+  cmark_chunk line;
+  bool line_in_place;
   bufsize_t last_line_length;
   cmark_strbuf linebuf;
   cmark_strbuf content;
+  // Paragraph content borrowed from 'input' rather than copied into
+  // 'content', which stays empty while this is set.
+  cmark_chunk borrowed;
+  // Writable copy of the whole input, newline-terminated, when it is
+  // parsed in one go.  NULL when input is fed in pieces.
+  unsigned char *input;
+  size_t input_len;
   int options;
+  // Copies an input line into curline, validating UTF-8 if requested.
+  // Chosen once from the options when the parser is created.
+  void (*put_line)(cmark_strbuf *buf, const unsigned char *data,
+                   bufsize_t len);
   bool last_buffer_ended_with_cr;
   unsigned int total_size;
+  /* Preview limits; zero means unlimited. */
+  int max_blocks;
+  size_t max_bytes;
+  int block_count;
+  size_t consumed_bytes;
+  struct cmark_node *last_counted_block;
+  // Last top-level block returned by cmark_parser_next_block.
+  struct cmark_node *last_block;
+  // Summary counted into once inline parsing has started.
+  struct cmark_document_summary *summary;
+  // Input lines kept for the document with CMARK_OPT_RETAIN_SOURCE.
+  struct cmark_source *source;
+  // Line starts recorded for the document with CMARK_OPT_SOURCE_OFFSETS.
+  struct cmark_line_index *line_index;
 };
 
 #ifdef __cplusplus
@@ -57,8 +57,8 @@ void cmark_reference_create(cmark_reference_map *map, cmark_chunk *label,
 
   ref = (cmark_reference *)map->mem->calloc(1, sizeof(*ref));
   ref->label = reflabel;
-  ref->url = cmark_clean_url(map->mem, url);
-  ref->title = cmark_clean_title(map->mem, title);
+  ref->url = cmark_clean_url(map->mem, url, NULL);
+  ref->title = cmark_clean_title(map->mem, title, NULL);
   ref->age = map->size;
   ref->next = map->refs;
 
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "buffer.h"
 #include "cmark.h"
 #include "utf8.h"
@@ -18,18 +19,10 @@ static inline void S_blankline(cmark_renderer *renderer) {
   }
 }
 
-static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
-                  cmark_escaping escape) {
-  int length = (int)strlen(source);
-  unsigned char nextc;
-  int32_t c;
-  int i = 0;
-  int last_nonspace;
-  int len;
+// Emits the newlines requested by cr and blankline.
+static void S_flush_cr(cmark_renderer *renderer) {
   int k = renderer->buffer->size - 1;
 
-  wrap = wrap && !renderer->no_linebreaks;
-
   if (renderer->in_tight_list_item && renderer->need_cr > 1) {
     renderer->need_cr = 1;
   }
@@ -49,6 +42,20 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
     renderer->begin_content = true;
     renderer->need_cr -= 1;
   }
+}
+
+static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
+                  cmark_escaping escape) {
+  int length = (int)strlen(source);
+  unsigned char nextc;
+  int32_t c;
+  int i = 0;
+  int last_nonspace;
+  int len;
+
+  wrap = wrap && !renderer->no_linebreaks;
+
+  S_flush_cr(renderer);
 
   while (i < length) {
     if (renderer->begin_line) {
@@ -148,6 +155,39 @@ void cmark_render_code_point(cmark_renderer *renderer, uint32_t c) {
   renderer->column += 1;
 }
 
+// Copies source text, which may span several lines, to the output as is
+// apart from the prefix.  No wrapping or escaping is done.
+void cmark_render_verbatim(cmark_renderer *renderer, const unsigned char *data,
+                           bufsize_t len) {
+  bufsize_t i = 0;
+
+  S_flush_cr(renderer);
+  while (i < len) {
+    const unsigned char *eol =
+        (const unsigned char *)memchr(data + i, '\n', (size_t)(len - i));
+    bufsize_t end = eol ? (bufsize_t)(eol - data) : len;
+
+    if (renderer->begin_line) {
+      cmark_strbuf_put(renderer->buffer, renderer->prefix->ptr,
+                       renderer->prefix->size);
+      renderer->column = renderer->prefix->size;
+    }
+    cmark_strbuf_put(renderer->buffer, data + i, end - i);
+    renderer->column += end - i;
+    renderer->begin_line = false;
+    renderer->begin_content = false;
+    if (eol) {
+      cmark_strbuf_putc(renderer->buffer, '\n');
+      renderer->column = 0;
+      renderer->begin_line = true;
+      renderer->begin_content = true;
+      end++;
+    }
+    i = end;
+  }
+  renderer->last_breakable = 0;
+}
+
 char *cmark_render(cmark_node *root, int options, int width,
                    void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
                                 unsigned char),
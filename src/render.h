@@ -43,6 +43,9 @@ void cmark_render_ascii(cmark_renderer *renderer, const char *s);
 
 void cmark_render_code_point(cmark_renderer *renderer, uint32_t c);
 
+void cmark_render_verbatim(cmark_renderer *renderer, const unsigned char *data,
+                           bufsize_t len);
+
 char *cmark_render(cmark_node *root, int options, int width,
                    void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
                                 unsigned char),
@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "source.h"
+#include "utf8.h"
+
+cmark_source *cmark_source_new(cmark_mem *mem) {
+  cmark_source *source = (cmark_source *)mem->calloc(1, sizeof(cmark_source));
+
+  source->mem = mem;
+  cmark_strbuf_init(mem, &source->text, 0);
+  return source;
+}
+
+void cmark_source_free(cmark_source *source) {
+  if (source == NULL) {
+    return;
+  }
+  cmark_strbuf_free(&source->text);
+  source->mem->free(source->lines);
+  source->mem->free(source->blocks);
+  source->mem->free(source);
+}
+
+void cmark_source_add_line(cmark_source *source, int line_number,
+                           const unsigned char *data, bufsize_t len) {
+  cmark_source_line line;
+
+  if (line_number > source->lines_capacity) {
+    int capacity = source->lines_capacity ? source->lines_capacity : 32;
+    while (capacity < line_number) {
+      capacity *= 2;
+    }
+    source->lines = (cmark_source_line *)source->mem->realloc(
+        source->lines, (size_t)capacity * sizeof(cmark_source_line));
+    source->lines_capacity = capacity;
+  }
+
+  // Spoiler openers advance the line number an extra time.
+  while (source->num_lines + 1 < line_number) {
+    source->lines[source->num_lines] = source->lines[source->num_lines - 1];
+    source->num_lines++;
+  }
+
+  if (source->num_lines) {
+    cmark_strbuf_putc(&source->text, '\n');
+  }
+  line.start = source->text.size;
+  line.len = len;
+  cmark_strbuf_put(&source->text, data, len);
+  source->lines[source->num_lines++] = line;
+}
+
+#ifndef CMARK_LEAN_NODES
+static bool S_is_blank_line(const unsigned char *data, bufsize_t len) {
+  bufsize_t i;
+
+  for (i = 0; i < len; i++) {
+    if (data[i] != ' ' && data[i] != '\t') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// True if the source of the subtree rooted at 'node' can't stand in for
+// it: a block has links resolved through reference definitions, or a
+// fenced code block or spoiler lacks its closing fence, so text following
+// the copy would run into it.
+static bool S_needs_rendering(cmark_node *node) {
+  cmark_node *cur = node;
+
+  while (cur) {
+    if ((cur->flags & CMARK_NODE__REFERENCE_LINKS) ||
+        (cur->type == CMARK_NODE_CODE_BLOCK && cur->as.code.fenced &&
+         !(cur->flags & CMARK_NODE__FENCE_CLOSED)) ||
+        (cur->type == CMARK_NODE_SPOILER &&
+         !(cur->flags & CMARK_NODE__FENCE_CLOSED))) {
+      return true;
+    }
+    if (cur->first_child && cur->first_child->type <= CMARK_NODE_LAST_BLOCK) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != node && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == node ? NULL : cur->next;
+  }
+  return false;
+}
+#endif
+
+static int S_compare_blocks(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)((const cmark_source_block *)a)->node;
+  uintptr_t y = (uintptr_t)((const cmark_source_block *)b)->node;
+  return x < y ? -1 : x > y;
+}
+
+void cmark_source_index_blocks(cmark_source *source, cmark_node *root) {
+#ifdef CMARK_LEAN_NODES
+  (void)source;
+  (void)root;
+#else
+  cmark_node *child;
+  size_t count = 0;
+
+  for (child = root->first_child; child; child = child->next) {
+    count++;
+  }
+  source->mem->free(source->blocks);
+  source->blocks = (cmark_source_block *)source->mem->calloc(
+      count ? count : 1, sizeof(cmark_source_block));
+  source->num_blocks = 0;
+
+  for (child = root->first_child; child; child = child->next) {
+    cmark_source_block *block;
+    cmark_source_line *first, *last;
+    int end_line = child->end_line;
+
+    // A spoiler's end leaves out its closing fence, which is the next line
+    // unless the input ended first.  Setext headings end on the line after
+    // their underline; the next block starting there bounds them.
+    if (child->type == CMARK_NODE_SPOILER && end_line < source->num_lines) {
+      end_line++;
+    }
+    if (child->next && child->next->start_line <= end_line) {
+      end_line = child->next->start_line - 1;
+    }
+    if (child->start_line < 1 || end_line > source->num_lines ||
+        end_line < child->start_line || S_needs_rendering(child)) {
+      continue;
+    }
+    first = &source->lines[child->start_line - 1];
+    last = &source->lines[end_line - 1];
+    // Trailing blank lines are left to the renderer.
+    while (end_line > child->start_line &&
+           S_is_blank_line(source->text.ptr + last->start, last->len)) {
+      last = &source->lines[--end_line - 1];
+    }
+
+    block = &source->blocks[source->num_blocks++];
+    block->node = child;
+    block->hash = cmark_node_get_hash(child);
+    block->start = first->start;
+    block->len = last->start + last->len - first->start;
+  }
+
+  qsort(source->blocks, source->num_blocks, sizeof(cmark_source_block),
+        S_compare_blocks);
+#endif
+}
+
+bool cmark_source_get_span(cmark_source *source, cmark_node *node,
+                           const unsigned char **data, bufsize_t *len) {
+  cmark_source_block key;
+  cmark_source_block *block;
+
+  if (source == NULL || source->num_blocks == 0) {
+    return false;
+  }
+  key.node = node;
+  block = (cmark_source_block *)bsearch(&key, source->blocks,
+                                        source->num_blocks,
+                                        sizeof(cmark_source_block),
+                                        S_compare_blocks);
+  // The node may have been edited, or freed and its memory reused.
+  if (block == NULL || cmark_node_get_hash(node) != block->hash) {
+    return false;
+  }
+  *data = source->text.ptr + block->start;
+  *len = block->len;
+  return true;
+}
+
+cmark_line_index *cmark_line_index_new(cmark_mem *mem) {
+  cmark_line_index *index =
+      (cmark_line_index *)mem->calloc(1, sizeof(cmark_line_index));
+
+  index->mem = mem;
+  return index;
+}
+
+void cmark_line_index_free(cmark_line_index *index) {
+  if (index == NULL) {
+    return;
+  }
+  index->mem->free(index->lines);
+  index->mem->free(index->runs);
+  index->mem->free(index->replacements);
+  index->mem->free(index);
+}
+
+void cmark_line_index_advance(cmark_line_index *index,
+                              const unsigned char *data, bufsize_t len) {
+  size_t units = 0;
+  bufsize_t i;
+
+  // Continuation bytes add nothing, and four-byte sequences take a
+  // surrogate pair.
+  for (i = 0; i < len; i++) {
+    if ((data[i] & 0xC0) != 0x80) {
+      units += data[i] >= 0xF0 ? 2 : 1;
+    }
+  }
+  index->input_bytes += (size_t)len;
+  index->input_units += units;
+}
+
+static void S_push_run(cmark_line_index *index, bufsize_t column,
+                       bufsize_t units, bufsize_t char_len) {
+  cmark_line_run *run;
+
+  if (index->num_runs == index->runs_capacity) {
+    index->runs_capacity = index->runs_capacity ? index->runs_capacity * 2 : 32;
+    index->runs = (cmark_line_run *)index->mem->realloc(
+        index->runs, (size_t)index->runs_capacity * sizeof(cmark_line_run));
+  }
+  run = &index->runs[index->num_runs++];
+  run->column = column;
+  run->units = units;
+  run->char_len = char_len;
+}
+
+static void S_push_replacement(cmark_line_index *index, bufsize_t column,
+                               bufsize_t len) {
+  cmark_line_replacement *replacement;
+
+  if (index->num_replacements == index->replacements_capacity) {
+    index->replacements_capacity =
+        index->replacements_capacity ? index->replacements_capacity * 2 : 8;
+    index->replacements = (cmark_line_replacement *)index->mem->realloc(
+        index->replacements, (size_t)index->replacements_capacity *
+                                 sizeof(cmark_line_replacement));
+  }
+  replacement = &index->replacements[index->num_replacements++];
+  replacement->column = column;
+  replacement->len = len;
+  replacement->shift = 0;
+}
+
+void cmark_line_index_replace_nul(cmark_line_index *index, bufsize_t column) {
+  S_push_replacement(index, column, 1);
+}
+
+void cmark_line_index_validate_line(cmark_line_index *index,
+                                    const unsigned char *data,
+                                    bufsize_t len) {
+  uint32_t first = index->line_replacements;
+  uint32_t num_nuls = index->num_replacements - first;
+  uint32_t nul = first;
+  bufsize_t i = 0, shift = 0;
+
+  // The replacements are rebuilt past the NUL bytes noted so far, then
+  // moved down over them.
+  while (i < len) {
+    bufsize_t invalid_len = 0;
+    bufsize_t end = i + cmark_utf8proc_find_invalid(data + i, len - i,
+                                                    &invalid_len);
+
+    while (nul < first + num_nuls && index->replacements[nul].column < end) {
+      S_push_replacement(index, index->replacements[nul].column + shift, 1);
+      nul++;
+    }
+    if (end >= len) {
+      break;
+    }
+    S_push_replacement(index, end + shift, invalid_len);
+    shift += 3 - invalid_len;
+    i = end + invalid_len;
+  }
+
+  memmove(&index->replacements[first], &index->replacements[first + num_nuls],
+          (size_t)(index->num_replacements - first - num_nuls) *
+              sizeof(cmark_line_replacement));
+  index->num_replacements -= num_nuls;
+}
+
+void cmark_line_index_add_line(cmark_line_index *index, int line_number,
+                               const unsigned char *data, bufsize_t len) {
+  cmark_line_offsets *line;
+  bufsize_t i = 0, units = 0, shift = 0;
+  uint32_t j;
+
+  if (line_number > index->lines_capacity) {
+    int capacity = index->lines_capacity ? index->lines_capacity : 32;
+    while (capacity < line_number) {
+      capacity *= 2;
+    }
+    index->lines = (cmark_line_offsets *)index->mem->realloc(
+        index->lines, (size_t)capacity * sizeof(cmark_line_offsets));
+    index->lines_capacity = capacity;
+  }
+
+  while (index->num_lines + 1 < line_number) {
+    index->lines[index->num_lines] = index->lines[index->num_lines - 1];
+    index->num_lines++;
+  }
+
+  line = &index->lines[index->num_lines++];
+  line->byte_start = index->line_bytes;
+  line->utf16_start = index->line_units;
+  line->len = len;
+  line->first_run = index->num_runs;
+  line->num_runs = 0;
+  line->first_replacement = index->line_replacements;
+  line->num_replacements = index->num_replacements - index->line_replacements;
+  index->line_replacements = index->num_replacements;
+  for (j = 0; j < line->num_replacements; j++) {
+    cmark_line_replacement *replacement =
+        &index->replacements[line->first_replacement + j];
+    shift += replacement->len - 3;
+    replacement->shift = shift;
+  }
+
+  // Leading ASCII needs no run.
+  while (i < len && data[i] < 0x80) {
+    i++;
+  }
+  units = i;
+  while (i < len) {
+    bufsize_t char_len = 1;
+
+    if (data[i] >= 0x80) {
+      int32_t c;
+      char_len = cmark_utf8proc_iterate(data + i, len - i, &c);
+      if (char_len < 0) {
+        char_len = 1;
+      }
+    }
+    if (line->num_runs == 0 ||
+        index->runs[index->num_runs - 1].char_len != char_len) {
+      S_push_run(index, i, units, char_len);
+      line->num_runs++;
+    }
+    units += char_len == 4 ? 2 : 1;
+    i += char_len;
+  }
+}
+
+// Returns the offsets of 'line' if 'column' lies within it or just past
+// its end.
+static cmark_line_offsets *S_get_line(cmark_line_index *index, int line,
+                                      int column) {
+  cmark_line_offsets *offsets;
+
+  if (index == NULL || line < 1 || line > index->num_lines) {
+    return NULL;
+  }
+  offsets = &index->lines[line - 1];
+  return column >= 1 && column <= offsets->len + 1 ? offsets : NULL;
+}
+
+bool cmark_line_index_get_byte_offset(cmark_line_index *index, int line,
+                                      int column, size_t *offset) {
+  cmark_line_offsets *offsets = S_get_line(index, line, column);
+  const cmark_line_replacement *replacements;
+  bufsize_t pos = column - 1;
+  uint32_t lo = 0, hi;
+
+  if (offsets == NULL) {
+    return false;
+  }
+
+  // Find the last replacement starting before 'pos'.
+  replacements = index->replacements + offsets->first_replacement;
+  hi = offsets->num_replacements;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (replacements[mid].column < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo > 0) {
+    const cmark_line_replacement *replacement = &replacements[lo - 1];
+    if (pos < replacement->column + 3) {
+      // Inside U+FFFD: the input it replaced starts there.
+      pos = replacement->column - (replacement->len - 3);
+    }
+    pos += replacement->shift;
+  }
+  *offset = offsets->byte_start + (size_t)pos;
+  return true;
+}
+
+bool cmark_line_index_get_utf16_offset(cmark_line_index *index, int line,
+                                       int column, size_t *offset) {
+  cmark_line_offsets *offsets = S_get_line(index, line, column);
+  const cmark_line_run *runs;
+  bufsize_t pos = column - 1;
+  bufsize_t units;
+  uint32_t lo = 0, hi;
+
+  if (offsets == NULL) {
+    return false;
+  }
+
+  // Find the last run starting at or before 'pos'.
+  runs = index->runs + offsets->first_run;
+  hi = offsets->num_runs;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (runs[mid].column <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    units = pos;
+  } else {
+    const cmark_line_run *run = &runs[lo - 1];
+    units = run->units + (pos - run->column) / run->char_len *
+                             (run->char_len == 4 ? 2 : 1);
+  }
+  *offset = offsets->utf16_start + (size_t)units;
+  return true;
+}
@@ -0,0 +1,154 @@
+#ifndef CMARK_SOURCE_H
+#define CMARK_SOURCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "cmark.h"
+
+typedef struct {
+  bufsize_t start;
+  bufsize_t len;
+} cmark_source_line;
+
+// A top-level block and the source it was parsed from.
+typedef struct {
+  cmark_node *node;
+  uint64_t hash;
+  bufsize_t start;
+  bufsize_t len;
+} cmark_source_block;
+
+// Input retained by CMARK_OPT_RETAIN_SOURCE: the lines as the parser saw
+// them, joined by newlines, and the top-level blocks that can be copied
+// back out of them.
+typedef struct cmark_source {
+  cmark_mem *mem;
+  cmark_strbuf text;
+  // Indexed by line number - 1.  Numbers the parser skips refer to the
+  // line before them.
+  cmark_source_line *lines;
+  int num_lines;
+  int lines_capacity;
+  // Sorted by node.
+  cmark_source_block *blocks;
+  size_t num_blocks;
+} cmark_source;
+
+cmark_source *cmark_source_new(cmark_mem *mem);
+
+void cmark_source_free(cmark_source *source);
+
+// Records the line numbered 'line_number', without its line ending.
+void cmark_source_add_line(cmark_source *source, int line_number,
+                           const unsigned char *data, bufsize_t len);
+
+// Indexes the top-level blocks of the freshly parsed 'root'.  Blocks using
+// link reference definitions are left out, since those definitions aren't
+// part of the tree.
+void cmark_source_index_blocks(cmark_source *source, cmark_node *root);
+
+// Finds the source of the top-level block 'node' if it hasn't changed
+// since it was indexed.
+bool cmark_source_get_span(cmark_source *source, cmark_node *node,
+                           const unsigned char **data, bufsize_t *len);
+
+// Characters 'char_len' bytes long making up a parsed line from byte
+// 'column' on, up to the next run.
+typedef struct {
+  bufsize_t column;
+  // UTF-16 code units in the line before 'column'.
+  bufsize_t units;
+  bufsize_t char_len;
+} cmark_line_run;
+
+// U+FFFD put in a parsed line in place of 'len' bytes of input: a NUL
+// byte, or invalid UTF-8 with CMARK_OPT_VALIDATE_UTF8.
+typedef struct {
+  // Where it starts in the parsed line.
+  bufsize_t column;
+  bufsize_t len;
+  // Bytes of input minus bytes parsed, up to its end.
+  bufsize_t shift;
+} cmark_line_replacement;
+
+typedef struct {
+  // Where the line starts in the input.
+  size_t byte_start;
+  size_t utf16_start;
+  // Length as parsed, without the line ending.
+  bufsize_t len;
+  // Runs of non-ASCII text and what follows it.  Lines without runs are
+  // ASCII.
+  uint32_t first_run;
+  uint32_t num_runs;
+  uint32_t first_replacement;
+  uint32_t num_replacements;
+} cmark_line_offsets;
+
+// Line starts recorded by CMARK_OPT_SOURCE_OFFSETS.
+typedef struct cmark_line_index {
+  cmark_mem *mem;
+  // Indexed by line number - 1, with skipped numbers as in cmark_source.
+  cmark_line_offsets *lines;
+  int num_lines;
+  int lines_capacity;
+  cmark_line_run *runs;
+  uint32_t num_runs;
+  uint32_t runs_capacity;
+  cmark_line_replacement *replacements;
+  uint32_t num_replacements;
+  uint32_t replacements_capacity;
+  // Replacements from here on belong to the line being read.
+  uint32_t line_replacements;
+  // Input counted so far, and where the line being read starts.
+  size_t input_bytes;
+  size_t input_units;
+  size_t line_bytes;
+  size_t line_units;
+} cmark_line_index;
+
+cmark_line_index *cmark_line_index_new(cmark_mem *mem);
+
+void cmark_line_index_free(cmark_line_index *index);
+
+// Counts 'len' bytes of raw input.
+void cmark_line_index_advance(cmark_line_index *index,
+                              const unsigned char *data, bufsize_t len);
+
+// Marks the input counted so far as the start of the next line.
+static inline void cmark_line_index_start_line(cmark_line_index *index) {
+  index->line_bytes = index->input_bytes;
+  index->line_units = index->input_units;
+}
+
+// Notes a NUL byte replaced at byte 'column' of the line being read.
+void cmark_line_index_replace_nul(cmark_line_index *index, bufsize_t column);
+
+// Notes the invalid UTF-8 that CMARK_OPT_VALIDATE_UTF8 replaces in the
+// line being read, 'data' being the line with its NUL bytes replaced.
+void cmark_line_index_validate_line(cmark_line_index *index,
+                                    const unsigned char *data,
+                                    bufsize_t len);
+
+// Records the line numbered 'line_number' as parsed, without its line
+// ending, starting where it was last marked.
+void cmark_line_index_add_line(cmark_line_index *index, int line_number,
+                               const unsigned char *data, bufsize_t len);
+
+bool cmark_line_index_get_byte_offset(cmark_line_index *index, int line,
+                                      int column, size_t *offset);
+
+bool cmark_line_index_get_utf16_offset(cmark_line_index *index, int line,
+                                       int column, size_t *offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
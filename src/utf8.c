@@ -107,32 +107,40 @@ static int utf8proc_valid(const uint8_t *str, bufsize_t str_len) {
   return length;
 }
 
-void cmark_utf8proc_check(cmark_strbuf *ob, const uint8_t *line,
-                          bufsize_t size) {
+bufsize_t cmark_utf8proc_find_invalid(const uint8_t *line, bufsize_t size,
+                                      bufsize_t *len) {
   bufsize_t i = 0;
 
   while (i < size) {
-    bufsize_t org = i;
-    int charlen = 0;
-
-    while (i < size) {
-      if (line[i] < 0x80 && line[i] != 0) {
-        i++;
-      } else if (line[i] >= 0x80) {
-        charlen = utf8proc_valid(line + i, size - i);
-        if (charlen < 0) {
-          charlen = -charlen;
-          break;
-        }
-        i += charlen;
-      } else if (line[i] == 0) {
-        // ASCII NUL is technically valid but rejected
-        // for security reasons.
-        charlen = 1;
+    if (line[i] < 0x80 && line[i] != 0) {
+      i++;
+    } else if (line[i] >= 0x80) {
+      int charlen = utf8proc_valid(line + i, size - i);
+      if (charlen < 0) {
+        *len = -charlen;
         break;
       }
+      i += charlen;
+    } else {
+      // ASCII NUL is technically valid but rejected
+      // for security reasons.
+      *len = 1;
+      break;
     }
+  }
+
+  return i;
+}
+
+void cmark_utf8proc_check(cmark_strbuf *ob, const uint8_t *line,
+                          bufsize_t size) {
+  bufsize_t i = 0;
+
+  while (i < size) {
+    bufsize_t charlen = 0;
+    bufsize_t org = i;
 
+    i += cmark_utf8proc_find_invalid(line + i, size - i, &charlen);
     if (i > org) {
       cmark_strbuf_put(ob, line + org, i - org);
     }
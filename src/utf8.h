@@ -12,6 +12,10 @@ void cmark_utf8proc_case_fold(cmark_strbuf *dest, const uint8_t *str,
                               bufsize_t len);
 void cmark_utf8proc_encode_char(int32_t uc, cmark_strbuf *buf);
 int cmark_utf8proc_iterate(const uint8_t *str, bufsize_t str_len, int32_t *dst);
+// Returns the offset in 'line' of the first NUL byte or invalid UTF-8
+// sequence, setting '*len' to its length, or 'size' if there is none.
+bufsize_t cmark_utf8proc_find_invalid(const uint8_t *line, bufsize_t size,
+                                      bufsize_t *len);
 void cmark_utf8proc_check(cmark_strbuf *dest, const uint8_t *line,
                           bufsize_t size);
 int cmark_utf8proc_is_space(int32_t uc);